@@ -18,6 +18,38 @@
 #include <openssl/bn.h>
 #include "dh_local.h"
 #include "crypto/dh.h"
+/* This file implements the entry points outside the allocation-free profile */
+#define DH_CHECK_ALLOW_ALLOC
+#include "dh_check_local.h"
+#ifndef FIPS_MODULE
+# include <openssl/async.h>
+# include <openssl/core_names.h>
+# include <openssl/evp.h>
+# include <openssl/params.h>
+# include <openssl/sha.h>
+# if defined(OPENSSL_THREADS) && defined(OPENSSL_SYS_UNIX)
+#  define DH_CHECK_EXECUTOR_PTHREADS
+#  include <pthread.h>
+#  include <time.h>
+#  ifdef __linux__
+#   include <errno.h>
+#   include <unistd.h>
+#   include <sys/resource.h>
+#   include <sys/syscall.h>
+#   if defined(SYS_sched_setaffinity) && defined(SYS_gettid)
+#    define DH_CHECK_EXECUTOR_PLACEMENT
+#   endif
+#  endif
+# endif
+# if defined(OPENSSL_DH_CHECK_PROFILE) && defined(__linux__) \
+     && defined(DH_CHECK_EXECUTOR_PTHREADS)
+#  define DH_CHECK_PROFILE
+#  include <linux/perf_event.h>
+# endif
+#endif
+#if defined(OPENSSL_DH_CHECK_NO_ALLOC) && defined(DH_CHECK_PROFILE)
+# error "OPENSSL_DH_CHECK_NO_ALLOC and OPENSSL_DH_CHECK_PROFILE are exclusive"
+#endif
 
 /**
 @file dh_check.c
@@ -139,7 +171,7 @@ Critical memory rules:
 - BN_CTX_start() must be paired with BN_CTX_end() before BN_CTX_free()
 - BN_CTX context must be freed on all code paths (including error paths)
 - Temporary BIGNUMs from BN_CTX_get() do not need individual freeing
-- two_powN in ossl_dh_check_priv_key() must be freed via BN_free()
+- Only free new_ctx, never a BN_CTX passed in by the caller
 
 @section MAINTAINER_TRAPS
 
@@ -156,6 +188,9 @@ GOTCHA: Forgetting BN_CTX_end() leaks the BIGNUM stack frame (not the context it
 HIGH: FIPS vs non-FIPS code paths diverge significantly
 Lines 47-109: Conditional compilation via #ifdef FIPS_MODULE
 GOTCHA: Changes to validation logic may need duplication in both branches
+GOTCHA: Both strategies are static helpers (dh_check_params_fips186_4(),
+dh_check_params_explicit(), dh_check_explicit()) so ossl_dh_check_strategy()
+can select either at run time - the #ifdef only picks the DH_check() default
 Historical: FIPS module separation mandated by FIPS 140-2 requirements
 
 MEDIUM: Private key validation has multiple code paths
@@ -168,6 +203,18 @@ Pattern: *ret |= FLAG instead of *ret = FLAG
 WHY: Allows multiple validation failures to be reported simultaneously
 GOTCHA: Caller must initialize *ret = 0 (we do this, but API contract requires it)
 
+MEDIUM: Check functions must stay strictly read-only on the DH
+Pattern: DH_get_nid(dh) only reads params.nid, which ossl_dh_cache_named_group()
+resolves once when p, q and g are set (DH_set0_pqg(), fromdata, decoding)
+WHY: One shared DH group object is validated against from many threads at once;
+any write to it bounces its cache line between cores and is a data race
+GOTCHA: Never cast away const on dh in this file, not even for DH_get_nid() -
+state derived from the parameters belongs in parameter-set code or in a
+separate object (DH_CHECK_CACHE, DH_CHECK_HOT)
+GOTCHA: Do not call ossl_dh_generate_public_key() from a check - with
+DH_FLAG_CACHE_MONT_P it fills dh->method_mont_p under dh->lock; the pairwise
+checks build their own BN_MONT_CTX instead
+
 LOW: Generator validation differs when q is present vs absent
 Lines 178-195 (with q) vs Lines 87-93 (without q)
 WHY: With q, we can verify g^q == 1 mod p; without q, we only check range
@@ -369,34 +416,245 @@ Local Variables (15 symbols):
   [LIFETIME: Valid between BN_CTX_start() and BN_CTX_end()]
   [SCOPE_PAIRING: Automatically freed by BN_CTX_end()]
   
-- BIGNUM *two_powN: Heap-allocated BIGNUM for computing 2^length (used in private key validation)
-  [SCOPE_PAIRING: BN_new() MUST be paired with BN_free()]
-  [NULL_SAFETY: BN_free() is NULL-safe]
-  [SCOPE_EXIT: After BN_free(), pointer is INVALID]
-  
-- BIGNUM *upper: Pointer to upper bound for private key validation (aliases either q or two_powN)
-  [NULL_SAFETY: Pointer, not owned - do not free]
-  [SCOPE_DEPENDENCY: Points to either dh->params.q or two_powN depending on code path]
-  
 - int length: Private key bit length for validation
   [VALID_RANGE: 0 (no preference) or positive]
   
-- BIGNUM *pub_key: Heap-allocated BIGNUM for pairwise consistency check (recalculated public key)
-  [SCOPE_PAIRING: BN_new() MUST be paired with BN_free()]
-  [SCOPE_EXIT: After BN_free(), pointer is INVALID]
+- BIGNUM *pub_key: BN_CTX temporary for pairwise consistency check (recalculated public key)
+  [LIFETIME: Valid between BN_CTX_start() and BN_CTX_end()]
+  [SCOPE_PAIRING: Automatically freed by BN_CTX_end(), do not call BN_free()]
+
+- BN_CTX *new_ctx: BN_CTX created when the caller passed ctx == NULL
+  [SCOPE_PAIRING: Freed with BN_CTX_free() on every path; NULL when the caller owns ctx]
+
+═══════════════════════════════════════════════════════════════════════
+Selection, Check and Profiling Constants (40 symbols):
+[SCOPE: Macros declared in dh_check_local.h]
+[LINKAGE: None (preprocessor)]
+[LIFETIME: Compile-time]
+[STORAGE: None (constants)]
+[SECURITY_SCOPE: Select which checks run and how results are recorded]
+[SCOPE_VIOLATIONS: Passing a DH_CHECK_MASK_* subset where DH_check() semantics are required → untested parameters accepted]
+[CVE_HISTORY: None]
+[VALIDATION: Unknown strategy, job type, phase or size values are rejected by the functions taking them]
+
+- DH_CHECK_STRATEGY_DEFAULT, DH_CHECK_STRATEGY_EXPLICIT, DH_CHECK_STRATEGY_FIPS186_4,
+  DH_CHECK_STRATEGY_PREFER_SEED: 0-3 - Validation strategy for ossl_dh_check_params_strategy()
+  and ossl_dh_check_strategy()
+  [CRITICAL: FIPS186_4 needs the seed; PREFER_SEED falls back to EXPLICIT without one]
+
+- DH_CHECK_MASK_GENERATOR, DH_CHECK_MASK_Q_PRIME, DH_CHECK_MASK_Q_DIVIDES_P,
+  DH_CHECK_MASK_J, DH_CHECK_MASK_P_PRIME, DH_CHECK_MASK_P_SAFE_PRIME,
+  DH_CHECK_MASK_ALL: 0x01-0x3F - DH_check() tests selectable through ossl_dh_check_mask()
+  [CRITICAL: Only DH_CHECK_MASK_ALL is equivalent to DH_check()]
+
+- DH_KEY_USAGE_EPHEMERAL, DH_KEY_USAGE_STATIC: 1, 2 - Key usage hints for
+  ossl_dh_check_pub_key_policy() and ossl_dh_validate_pub_key()
+
+- DH_PUBKEY_CHECK_PARTIAL, DH_PUBKEY_CHECK_FULL: 1, 2 - Public key validation
+  level applied (SP800-56Ar3 5.6.2.3.2 vs 5.6.2.3.1)
+  [CRITICAL: PARTIAL does not prove subgroup membership]
+
+- DH_CHECK_JOB_PARAMS, DH_CHECK_JOB_PUB_KEY, DH_CHECK_JOB_PAIRWISE: 1-3 - Work
+  carried by a DH_CHECK_JOB
+
+- DH_PARAMS_FINGERPRINT_LEN: SHA256_DIGEST_LENGTH - Size of ossl_dh_params_fingerprint() output
+
+- DH_PROVENANCE_VERSION, DH_PROVENANCE_LEN, DH_PROVENANCE_MIN_KEY_LEN: 1, 34, 16 -
+  Pair-wise provenance record layout and minimum MAC key length
+
+- DH_CHECK_HOT_DEFAULT_THRESHOLD, DH_CHECK_HOT_DEFAULT_MAX_GROUPS,
+  DH_CHECK_HOT_MAX_NODES: 64, 32, 8 - Promotion threshold, tracked groups and
+  NUMA nodes with their own replica in a DH_CHECK_HOT
+  [PERFORMANCE_SCOPE: Nodes above DH_CHECK_HOT_MAX_NODES share replicas modulo the limit]
+  [PERFORMANCE_SCOPE: Node placement is best effort - replicas rely on first-touch
+  and are not bound to a node; builds without SYS_getcpu use one replica]
+
+- DH_CHECK_PROF_PARAMS, DH_CHECK_PROF_GENERATOR, DH_CHECK_PROF_Q_PRIME,
+  DH_CHECK_PROF_Q_DIVIDES_P, DH_CHECK_PROF_P_PRIME, DH_CHECK_PROF_P_SAFE_PRIME,
+  DH_CHECK_PROF_PUB_KEY, DH_CHECK_PROF_PAIRWISE, DH_CHECK_PROF_NPHASES: 0-8 -
+  Profiled phases of the validation paths
+
+- DH_CHECK_PROF_NSIZES: 7 - Modulus size buckets of the profiler
+
+- DH_CHECK_PROF_CYCLES, DH_CHECK_PROF_INSTRUCTIONS, DH_CHECK_PROF_CACHE_MISSES,
+  DH_CHECK_PROF_BRANCH_MISSES, DH_CHECK_PROF_NCOUNTERS: 0-4 - Hardware counters
+  recorded per phase
+
+═══════════════════════════════════════════════════════════════════════
+File-local Build Switches and Macros (15 symbols):
+[SCOPE: File scope of dh_check.c]
+[LINKAGE: None (preprocessor)]
+[LIFETIME: Compile-time]
+[STORAGE: None]
+[SECURITY_SCOPE: Decide which optional code is compiled in]
+[SCOPE_VIOLATIONS: Using pthread or perf_event code outside its switch → build breaks on other platforms]
+[CVE_HISTORY: None]
+[VALIDATION: Derived from OPENSSL_THREADS, OPENSSL_SYS_UNIX, __linux__ and compiler builtins only]
+
+- DH_CHECK_EXECUTOR_PTHREADS: defined with OPENSSL_THREADS on OPENSSL_SYS_UNIX,
+  outside the FIPS module - Compiles the validation executor and the profiler's
+  per-thread state
+
+- DH_CHECK_EXECUTOR_PLACEMENT: defined on Linux when <sys/syscall.h> has
+  SYS_sched_setaffinity and SYS_gettid - Lets the executor pin its workers and
+  set their nice value; without it asking for either fails
+
+- DH_CHECK_EXECUTOR_MAX_CPUS: 1024 - CPU indices accepted for executor affinity
+
+- OPENSSL_DH_CHECK_PROFILE: build option - Requests hardware-counter profiling
+
+- DH_CHECK_PROFILE: defined when OPENSSL_DH_CHECK_PROFILE is set on Linux with
+  pthreads - Compiles the perf_event profiler
+  [PERFORMANCE_SCOPE: Without it the probes compile to nothing]
+
+- DH_PROF_BEGIN(s), DH_PROF_END(s, phase, dh): Probes around a profiled phase,
+  no-ops without DH_CHECK_PROFILE
+
+- OPENSSL_DH_CHECK_NO_ALLOC: build option - Allocation-free profile: the
+  entry points listed at ossl_dh_check_params_ctx() make no heap allocation
+  [PERFORMANCE_SCOPE: Excludes OPENSSL_DH_CHECK_PROFILE, whose per-thread state is malloc'd]
+
+- DH_CHECK_ALLOCATES: attribute macro in dh_check_local.h - With
+  OPENSSL_DH_CHECK_NO_ALLOC, GCC/Clang error attribute on the validation entry
+  points outside the profile; empty otherwise
+- DH_CHECK_ALLOW_ALLOC: defined before including dh_check_local.h - Turns
+  DH_CHECK_ALLOCATES off for code that implements or tests both kinds
+  (this file and its internal test)
+
+- DH_KNOWN_GROUPS_VERSION: 3 - Revision of the compiled-in dh_known_groups[] verdicts
+- DH_KNOWN_GROUP_MIN_BITS: 2048 - dh_known_groups[] hits below this size also
+  report DH_MODULUS_TOO_SMALL
+
+- DH_CHECK_HOT_ATOMICS: defined with GCC/Clang __atomic builtins unless
+  BROKEN_CLANG_ATOMICS - Makes hot-group lookups lock-free
+
+- DH_CHECK_HOT_LOAD(p), DH_CHECK_HOT_STORE(p, v): Acquire load and release
+  store with DH_CHECK_HOT_ATOMICS, plain accesses (under the tracker lock) without
+
+═══════════════════════════════════════════════════════════════════════
+Types (22 symbols):
+[SCOPE: Public types in dh_check_local.h; file-local types in dh_check.c]
+[LINKAGE: None (type names)]
+[LIFETIME: Compile-time]
+[STORAGE: Objects live on the heap unless noted]
+[SECURITY_SCOPE: Carry validation verdicts between calls]
+[SCOPE_VIOLATIONS: Reading a verdict for different parameters than it was computed for → unvalidated parameters accepted]
+[CVE_HISTORY: None]
+[VALIDATION: Opaque types are only reachable through their accessors]
+
+- DH_CHECK_CACHE: opaque - Per-component DH_check() verdict cache (ossl_dh_check_cached())
+- DH_VALIDATED_GROUP, DH_VALIDATED_PUBKEY: opaque - Type-state handles for
+  validated groups and public keys
+  [SCOPE_VIOLATIONS: A group handle records the fingerprint of the values
+  DH_check() passed and its accessors refuse the group once they change; a key
+  handle records that fingerprint and its validation level, and
+  ossl_dh_validated_pub_key_get0() refuses it for other values or a level it
+  did not get]
+- DH_CHECK_JOB: caller-owned struct - One unit of validation work and its result
+  [STORAGE: Caller-owned, may be stack or coroutine frame]
+- DH_CHECK_JOB_DONE_FN, DH_CHECK_EXECUTOR_FN: function types - Job completion
+  callback and pluggable executor
+- DH_CHECK_EXECUTOR: opaque - Library-owned worker pool with placement and metrics
+- DH_CHECK_EXECUTOR_STATS: struct - Queue depth and wait time snapshot
+- DH_CHECK_SET: opaque - Verdicts for a configuration's groups, built on reload
+- DH_CHECK_HOT: opaque - Usage tracker and per-node replicas for hot custom groups
+- DH_PUB_KEY_STREAM: caller-owned struct - State of an incremental public key range check
+  [STORAGE: Caller-owned, no allocation]
+- DH_CHECK_PROF_STATS: struct - Accumulated time and counters of one profiled phase
+- DH_PROF_THREAD, DH_PROF_SAMPLE: file-local - Per-thread perf_event descriptors
+  and the counter snapshot taken by DH_PROF_BEGIN()
+- DH_KNOWN_GROUP: file-local - Entry of dh_known_groups[]
+- DH_CHECK_EXECUTOR_ITEM, DH_CHECK_EXECUTOR_WAIT, DH_CHECK_EXECUTOR_BATCH,
+  DH_CHECK_EXECUTOR_BATCH_ITEM: file-local - Executor queue entry and the
+  completion state of ossl_dh_check_executor_run() and _run_batch()
+- DH_CHECK_SET_ENTRY: file-local - Fingerprint and verdict of one group in a DH_CHECK_SET
+- DH_CHECK_HOT_REPLICA, DH_CHECK_HOT_ENTRY: file-local - One node's copy of a hot
+  group with its Montgomery context, and the usage record of a tracked group
+
+═══════════════════════════════════════════════════════════════════════
+Globals (10 symbols):
+[SCOPE: File scope (static)]
+[LINKAGE: Internal]
+[LIFETIME: Process]
+[STORAGE: Static data]
+[SECURITY_SCOPE: dh_known_groups[] decides when DH_check() skips its tests]
+[SCOPE_VIOLATIONS: A wrong table verdict → invalid parameters reported valid]
+[CVE_HISTORY: None]
+[VALIDATION: Profiler state is only reachable under DH_CHECK_PROFILE]
+
+- dh_known_groups[]: const DH_KNOWN_GROUP - Verdicts of well-known non-named groups
+  [CRITICAL: Entry flags must match DH_check() exactly; see DH_KNOWN_GROUPS_VERSION.
+  Hits below DH_KNOWN_GROUP_MIN_BITS add DH_MODULUS_TOO_SMALL]
+  [VALIDATION: A hit requires p, g and q equal in value and sign]
+- dh_oakley768_p[], dh_oakley1024_p[]: const unsigned char - Big-endian RFC 2409
+  primes the table entries compare p against
+- dh_prof_config[], dh_prof_bucket_bits[]: const - perf_event counter types and
+  size bucket limits
+- dh_prof_once, dh_prof_key, dh_prof_key_ok: pthread_once_t, pthread_key_t, int -
+  Lazy set-up of the per-thread counter key
+- dh_prof_lock: pthread_mutex_t - Guards dh_prof_stats
+- dh_prof_stats[][]: DH_CHECK_PROF_STATS - Accumulated profile per phase and size
+  [SCOPE_PAIRING: Read and written only with dh_prof_lock held]
+
+═══════════════════════════════════════════════════════════════════════
+External Functions (48 symbols):
+[SCOPE: Declared in dh_check_local.h]
+[LINKAGE: External]
+[LIFETIME: Program]
+[STORAGE: Text]
+[SECURITY_SCOPE: Validation entry points beyond the DH_check*() family]
+[SCOPE_VIOLATIONS: Calling the non-FIPS entry points from the FIPS module → link failure]
+[CVE_HISTORY: None]
+[VALIDATION: Each function documents its inputs in its own header]
+
+- ossl_dh_check_params_strategy(), ossl_dh_check_strategy(): Run-time strategy selection
+- ossl_dh_check_mask(): Caller-selected subset of DH_check()
+- ossl_dh_check_params_ctx(), ossl_dh_check_ctx(), ossl_dh_check_pairwise_ctx():
+  Checks on a caller-supplied BN_CTX
+- ossl_dh_check_cache_new(), ossl_dh_check_cache_free(), ossl_dh_check_cached():
+  Per-component verdict cache
+- ossl_dh_check_pub_key_policy(): Partial or full public key check by group and usage
+- ossl_dh_check_pub_key_partial_batch(): Partial check of many fixed-width keys
+- ossl_dh_pub_key_stream_init(), ossl_dh_pub_key_stream_feed(),
+  ossl_dh_pub_key_stream_final(): Incremental public key range check
+- ossl_dh_validate_group(), ossl_dh_validated_group_get0_dh(),
+  ossl_dh_validated_group_free(), ossl_dh_validate_pub_key(),
+  ossl_dh_validated_pub_key_get0(), ossl_dh_validated_pub_key_free(): Type-state handles
+- ossl_dh_check_async(), ossl_dh_check_job_init(), ossl_dh_check_job_submit(),
+  ossl_dh_check_job_result(): Asynchronous validation jobs
+- ossl_dh_check_executor_new(), ossl_dh_check_executor_free(),
+  ossl_dh_check_executor_submit(), ossl_dh_check_executor_run(),
+  ossl_dh_check_executor_run_batch(), ossl_dh_check_executor_get_stats():
+  Validation executor (POSIX threads builds only)
+- ossl_dh_params_fingerprint(): SHA-256 identity of p, g, q and j
+- ossl_dh_check_reload(), ossl_dh_check_set_free(), ossl_dh_check_set_get(),
+  ossl_dh_check_set_get_counts(): Reload-time revalidation of changed groups
+- ossl_dh_check_hot_new(), ossl_dh_check_hot_free(),
+  ossl_dh_check_pub_key_hot(), ossl_dh_check_pub_key_hot_ctx(),
+  ossl_dh_check_pairwise_hot(), ossl_dh_check_pairwise_hot_ctx(),
+  ossl_dh_check_hot_num_promoted(), ossl_dh_check_hot_num_replicas(): Hot group
+  fast path
+- ossl_dh_check_prof_get(), ossl_dh_check_prof_reset(), ossl_dh_check_prof_print():
+  Profiler results
+- ossl_dh_pairwise_provenance_create(), ossl_dh_check_pairwise_provenance():
+  MAC'd pair-wise test records
 
 /**
  * @note CHECKPOINT PROOF - SYMBOL_DICTIONARY COMPLETENESS
- * Symbols scanned: 51
- * Dictionary entries created: 51
- * Completeness: 51 = 51 ? YES
+ * Symbols scanned: 186
+ * Dictionary entries created: 186
+ * Completeness: 186 = 186 ? YES
  * 
  * Breakdown:
  * - Constants/macros: 3 scanned, 3 documented
  * - Error codes: 13 scanned, 13 documented (includes error flag constants and reason codes)
  * - Special values: 2 scanned, 2 documented
  * - Structure fields: 8 scanned, 8 documented
- * - Globals: 0 scanned, 0 documented
+ * - Selection/check/profiling constants: 40 scanned, 40 documented
+ * - File-local switches and macros: 15 scanned, 15 documented
+ * - Types: 22 scanned, 22 documented
+ * - Globals: 10 scanned, 10 documented
+ * - External functions: 48 scanned, 48 documented
  * - Function params: 4 scanned, 4 documented (unique parameter types)
  * - Local variables: 21 scanned, 21 documented (includes all significant variables)
  * 
@@ -508,10 +766,8 @@ int DH_check_params_ex(const DH *dh)
     return errflags == 0;
 }
 
-#ifdef FIPS_MODULE
-
 /**
-@brief FIPS-compliant DH parameter validation
+@brief FIPS 186-4 regeneration strategy for DH parameter validation
 
 @param[in] dh DH parameter structure (must be initialized, not NULL)
 @param[out] ret Pointer to int for validation error flags (initialized to 0 by this function)
@@ -545,12 +801,20 @@ EDGE CASES:
 - Custom parameters: *ret may contain error flags from FIPS 186-4 validation
 - Allocation failure in FIPS validator: Returns 0, *ret contains failure flags
 
-@warning FIPS module only - different validation logic than non-FIPS version
+WHY THIS IS ALSO BUILT OUTSIDE THE FIPS MODULE:
+ossl_ffc_params_FIPS186_4_validate() is part of libcrypto in every build, so the
+regeneration strategy can be selected at run time through
+ossl_dh_check_params_strategy() and benchmarked against the explicit checks on
+the same binary.
+
+@warning Default strategy inside the FIPS module only - the non-FIPS default is
+         dh_check_params_explicit()
 @note This does NOT perform primality testing for known groups (trusted by approval)
+@note Error flags are FFC_* flags from the FIPS 186-4 validator, not DH_* flags
 
-@see DH_check_params() (non-FIPS version), ossl_ffc_params_FIPS186_4_validate()
+@see DH_check_params(), dh_check_params_explicit(), ossl_ffc_params_FIPS186_4_validate()
 */
-int DH_check_params(const DH *dh, int *ret)
+static int dh_check_params_fips186_4(const DH *dh, int *ret)
 {
     int nid;
 
@@ -559,7 +823,7 @@ int DH_check_params(const DH *dh, int *ret)
      * SP800-56A R3 Section 5.5.2 Assurances of Domain Parameter Validity
      * (1a) The domain parameters correspond to any approved safe prime group.
      */
-    nid = DH_get_nid((DH *)dh);
+    nid = DH_get_nid(dh);
     if (nid != NID_undef)
         return 1;
     /*
@@ -571,12 +835,227 @@ int DH_check_params(const DH *dh, int *ret)
                                               FFC_PARAM_TYPE_DH, ret, NULL);
 }
 
+#ifdef DH_CHECK_PROFILE
+/*
+ * Per-thread perf_event group. fd[i] is the counter DH_CHECK_PROF_* i, or -1
+ * if the kernel or CPU does not offer it; slot[i] is its position in a
+ * PERF_FORMAT_GROUP read of the leader.
+ */
+typedef struct dh_prof_thread_st {
+    int leader;
+    int fd[DH_CHECK_PROF_NCOUNTERS];
+    int slot[DH_CHECK_PROF_NCOUNTERS];
+} DH_PROF_THREAD;
+
+/* State captured at the start of one profiled phase */
+typedef struct dh_prof_sample_st {
+    DH_PROF_THREAD *thread;
+    uint64_t ns;
+    uint64_t value[DH_CHECK_PROF_NCOUNTERS];
+} DH_PROF_SAMPLE;
+
+# define DH_PROF_BEGIN(s)             dh_prof_begin(&(s))
+# define DH_PROF_END(s, phase, dh)    dh_prof_end(&(s), (phase), (dh))
+
+static const uint64_t dh_prof_config[DH_CHECK_PROF_NCOUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static const int dh_prof_bucket_bits[DH_CHECK_PROF_NSIZES - 1] = {
+    1024, 2048, 3072, 4096, 6144, 8192
+};
+
+static pthread_once_t dh_prof_once = PTHREAD_ONCE_INIT;
+static pthread_key_t dh_prof_key;
+static int dh_prof_key_ok;
+static pthread_mutex_t dh_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static DH_CHECK_PROF_STATS dh_prof_stats[DH_CHECK_PROF_NPHASES][DH_CHECK_PROF_NSIZES];
+
+/* pthread_key_create() destructor: close a thread's counters on exit */
+static void dh_prof_thread_free(void *arg)
+{
+    DH_PROF_THREAD *th = arg;
+    int i;
+
+    for (i = 0; i < DH_CHECK_PROF_NCOUNTERS; i++)
+        if (th->fd[i] >= 0)
+            close(th->fd[i]);
+    OPENSSL_free(th);
+}
+
+static void dh_prof_init(void)
+{
+    dh_prof_key_ok = pthread_key_create(&dh_prof_key, dh_prof_thread_free) == 0;
+}
+
+/*
+ * The calling thread's counter group, opened on first use. Counters the
+ * kernel refuses (no PMU in a VM, perf_event_paranoid, seccomp) are left
+ * out, so the worst case is a group with no counters at all - phases are
+ * then still counted and timed.
+ */
+static DH_PROF_THREAD *dh_prof_thread(void)
+{
+    struct perf_event_attr attr;
+    DH_PROF_THREAD *th;
+    int i, nopen = 0;
+
+    if (pthread_once(&dh_prof_once, dh_prof_init) != 0 || !dh_prof_key_ok)
+        return NULL;
+    if ((th = pthread_getspecific(dh_prof_key)) != NULL)
+        return th;
+    if ((th = OPENSSL_malloc(sizeof(*th))) == NULL)
+        return NULL;
+    th->leader = -1;
+    for (i = 0; i < DH_CHECK_PROF_NCOUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = dh_prof_config[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        th->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+                                 th->leader, 0);
+        th->slot[i] = th->fd[i] >= 0 ? nopen++ : -1;
+        if (th->fd[i] >= 0 && th->leader < 0)
+            th->leader = th->fd[i];
+    }
+    if (pthread_setspecific(dh_prof_key, th) != 0) {
+        dh_prof_thread_free(th);
+        return NULL;
+    }
+    return th;
+}
+
+/* Read the current counter values of a thread's group */
+static int dh_prof_read(const DH_PROF_THREAD *th, uint64_t *value)
+{
+    uint64_t buf[1 + DH_CHECK_PROF_NCOUNTERS];
+    int i;
+
+    if (th->leader < 0 || read(th->leader, buf, sizeof(buf)) <= 0)
+        return 0;
+    for (i = 0; i < DH_CHECK_PROF_NCOUNTERS; i++)
+        value[i] = th->slot[i] >= 0 ? buf[1 + th->slot[i]] : 0;
+    return 1;
+}
+
+static uint64_t dh_prof_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void dh_prof_begin(DH_PROF_SAMPLE *s)
+{
+    s->thread = dh_prof_thread();
+    if (s->thread != NULL && !dh_prof_read(s->thread, s->value))
+        s->thread->leader = -1;
+    s->ns = dh_prof_now_ns();
+}
+
+static void dh_prof_end(DH_PROF_SAMPLE *s, int phase, const DH *dh)
+{
+    DH_CHECK_PROF_STATS *st;
+    uint64_t value[DH_CHECK_PROF_NCOUNTERS];
+    uint64_t ns = dh_prof_now_ns() - s->ns;
+    int have = 0, bits, bucket, i;
+
+    if (s->thread != NULL)
+        have = dh_prof_read(s->thread, value);
+    bits = dh->params.p != NULL ? BN_num_bits(dh->params.p) : 0;
+    for (bucket = 0; bucket < DH_CHECK_PROF_NSIZES - 1; bucket++)
+        if (bits <= dh_prof_bucket_bits[bucket])
+            break;
+
+    pthread_mutex_lock(&dh_prof_lock);
+    st = &dh_prof_stats[phase][bucket];
+    st->calls++;
+    st->ns += ns;
+    for (i = 0; have && i < DH_CHECK_PROF_NCOUNTERS; i++) {
+        if (s->thread->slot[i] < 0)
+            continue;
+        st->count[i] += value[i] - s->value[i];
+        st->samples[i]++;
+    }
+    pthread_mutex_unlock(&dh_prof_lock);
+}
 #else
+typedef int DH_PROF_SAMPLE;
+# define DH_PROF_BEGIN(s)             ((void)0)
+# define DH_PROF_END(s, phase, dh)    ((void)(s))
+#endif /* DH_CHECK_PROFILE */
+
+/*
+ * Write p - |sub| as |len| big-endian bytes to |out|, propagating the borrow
+ * from the least significant byte. Fails if p does not fit in |len| bytes
+ * or is smaller than |sub|.
+ */
+static int dh_p_minus_bytes(const BIGNUM *p, unsigned int sub,
+                            unsigned char *out, size_t len)
+{
+    unsigned int v;
+    size_t j;
+
+    if (BN_bn2binpad(p, out, (int)len) < 0)
+        return 0;
+    for (j = len; sub != 0 && j-- > 0;) {
+        v = out[j];
+        out[j] = (unsigned char)(v - sub);
+        sub = v < sub;
+    }
+    return sub == 0;
+}
+
+#ifndef FIPS_MODULE
+# ifdef OPENSSL_DH_CHECK_NO_ALLOC
+/*
+ * 1 if g >= p - 1, comparing big-endian byte strings on the stack. A p too
+ * wide for the buffer is DH_MODULUS_TOO_LARGE anyway and is only compared
+ * with g >= p.
+ */
+static int dh_generator_too_large(const DH *dh, BN_CTX *ctx)
+{
+    unsigned char pm1[(OPENSSL_DH_MAX_MODULUS_BITS + 7) / 8];
+    unsigned char g[sizeof(pm1)];
+    size_t len = BN_num_bytes(dh->params.p);
+
+    if (len > sizeof(pm1))
+        return BN_cmp(dh->params.g, dh->params.p) >= 0;
+    if (!dh_p_minus_bytes(dh->params.p, 1, pm1, len)
+        || BN_bn2binpad(dh->params.g, g, (int)len) < 0)
+        return 1;
+    return memcmp(g, pm1, len) >= 0;
+}
+# else
+/* 1 if g >= p - 1, 0 if not, -1 on error */
+static int dh_generator_too_large(const DH *dh, BN_CTX *ctx)
+{
+    BIGNUM *tmp;
+    int r = -1;
+
+    BN_CTX_start(ctx);
+    tmp = BN_CTX_get(ctx);
+    if (tmp != NULL
+        && BN_copy(tmp, dh->params.p) != NULL
+        && BN_sub_word(tmp, 1))
+        r = BN_cmp(dh->params.g, tmp) >= 0;
+    BN_CTX_end(ctx);
+    return r;
+}
+# endif
 
 /**
-@brief Non-FIPS DH parameter validation (lightweight checks, no primality testing)
+@brief Explicit-check strategy for DH parameter validation (lightweight, no primality testing)
 
 @param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] ctx BN_CTX to take temporaries from, or NULL to use a private one
 @param[out] ret Pointer to int for validation error flags (initialized to 0 by this function)
 
 @return 1 on success (basic parameter checks passed)
@@ -585,12 +1064,13 @@ int DH_check_params(const DH *dh, int *ret)
 @details
 Algorithm Flow (Plain English):
 1. Initialize *ret = 0 (no errors)
-2. Create BN_CTX for temporary BIGNUM allocations
-3. Allocate temporary BIGNUM via BN_CTX_get()
-4. Check p is odd (even modulus is insecure)
-5. Check g is in valid range: 1 < g < p-1
-6. Check modulus size is within bounds [DH_MIN_MODULUS_BITS, OPENSSL_DH_MAX_MODULUS_BITS]
-7. Clean up BN_CTX and return success/failure
+2. Use the caller's BN_CTX, or create one if ctx is NULL
+3. Check p is odd (even modulus is insecure)
+4. Check g is in valid range: 1 < g < p-1, computing p-1 in a BN_CTX
+   temporary (with OPENSSL_DH_CHECK_NO_ALLOC: as bytes on the stack, and
+   no BN_CTX is used at all)
+5. Check modulus size is within bounds [DH_MIN_MODULUS_BITS, OPENSSL_DH_MAX_MODULUS_BITS]
+6. Clean up BN_CTX and return success/failure
 
 WHY THIS DESIGN (NON-FIPS):
 This performs only the checks that are fast and essential:
@@ -623,22 +1103,23 @@ EDGE CASES:
 @warning This does NOT verify p is prime - use DH_check() for cryptographic validation
 @warning Parameters passing this check may still be cryptographically weak
 
-@see DH_check_params_ex(), DH_check()
+@see DH_check_params(), DH_check_params_ex(), DH_check()
 */
-int DH_check_params(const DH *dh, int *ret)
+static int dh_check_params_explicit(const DH *dh, BN_CTX *ctx, int *ret)
 {
-    int ok = 0;
-    BIGNUM *tmp = NULL;
-    BN_CTX *ctx = NULL;
+    int ok = 0, too_large;
+    BN_CTX *new_ctx = NULL;
+    DH_PROF_SAMPLE prof;
 
     *ret = 0;
-    ctx = BN_CTX_new_ex(dh->libctx);
-    if (ctx == NULL)
-        goto err;
-    BN_CTX_start(ctx);
-    tmp = BN_CTX_get(ctx);
-    if (tmp == NULL)
-        goto err;
+    DH_PROF_BEGIN(prof);
+# ifndef OPENSSL_DH_CHECK_NO_ALLOC
+    if (ctx == NULL) {
+        ctx = new_ctx = BN_CTX_new_ex(dh->libctx);
+        if (ctx == NULL)
+            return 0;
+    }
+# endif
 
     if (!BN_is_odd(dh->params.p))
         *ret |= DH_CHECK_P_NOT_PRIME;
@@ -646,9 +1127,9 @@ int DH_check_params(const DH *dh, int *ret)
         || BN_is_zero(dh->params.g)
         || BN_is_one(dh->params.g))
         *ret |= DH_NOT_SUITABLE_GENERATOR;
-    if (BN_copy(tmp, dh->params.p) == NULL || !BN_sub_word(tmp, 1))
+    if ((too_large = dh_generator_too_large(dh, ctx)) < 0)
         goto err;
-    if (BN_cmp(dh->params.g, tmp) >= 0)
+    if (too_large)
         *ret |= DH_NOT_SUITABLE_GENERATOR;
     if (BN_num_bits(dh->params.p) < DH_MIN_MODULUS_BITS)
         *ret |= DH_MODULUS_TOO_SMALL;
@@ -657,12 +1138,43 @@ int DH_check_params(const DH *dh, int *ret)
 
     ok = 1;
  err:
-    BN_CTX_end(ctx);
-    BN_CTX_free(ctx);
+    BN_CTX_free(new_ctx);
+    DH_PROF_END(prof, DH_CHECK_PROF_PARAMS, dh);
     return ok;
 }
 #endif /* FIPS_MODULE */
 
+/**
+@brief DH parameter validation using the build's default strategy
+
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by callee)
+
+@return 1 on success (checks completed - inspect *ret for failures)
+@retval 0 on failure (allocation error or FIPS validation failure)
+
+@details
+Algorithm Flow (Plain English):
+1. FIPS module: run dh_check_params_fips186_4() (approved group or FIPS 186-4)
+2. Otherwise: run dh_check_params_explicit() (odd p, g range, size bounds)
+
+WHY THIS DESIGN:
+Both strategies are compiled as static helpers so that
+ossl_dh_check_params_strategy() can pick either one at run time. This public
+entry point keeps the historical per-build behavior unchanged.
+
+@see dh_check_params_fips186_4(), dh_check_params_explicit(),
+     ossl_dh_check_params_strategy()
+*/
+int DH_check_params(const DH *dh, int *ret)
+{
+#ifdef FIPS_MODULE
+    return dh_check_params_fips186_4(dh, ret);
+#else
+    return dh_check_params_explicit(dh, NULL, ret);
+#endif
+}
+
 /*-
  * Check that p is a safe prime and
  * g is a suitable generator.
@@ -741,121 +1253,325 @@ int DH_check_ex(const DH *dh)
     return errflags == 0;
 }
 
-/* Note: according to documentation - this only checks the params */
-
 /**
-@brief Full cryptographic validation of DH parameters (includes expensive primality testing)
+@brief Compute a SHA-256 fingerprint of the domain parameters p, g, q and j
 
 @param[in] dh DH parameter structure (must be initialized, not NULL)
-@param[out] ret Pointer to int for validation error flags (initialized to 0 by this function)
+@param[out] md DH_PARAMS_FINGERPRINT_LEN bytes of fingerprint
 
-@return 1 on success (all validations passed)
-@retval 0 on failure (allocation error during validation - check *ret for specific failures)
+@return 1 on success
+@retval 0 if a component is negative or larger than
+        OPENSSL_DH_MAX_MODULUS_BITS
 
 @details
 Algorithm Flow (Plain English):
-
-FIPS MODULE VERSION (simpler):
-1. Delegates entirely to DH_check_params() which handles FIPS 186-4 validation
-2. No additional checks performed
-
-NON-FIPS MODULE VERSION (comprehensive):
-1. Initialize *ret = 0
-2. Check if parameters are from known approved group (NID != NID_undef) - if yes, return success immediately
-3. Call DH_check_params() for basic structural validation (p odd, g valid, size bounds)
-4. If basic checks fail, return 0 (don't proceed to expensive checks)
-5. Allocate BN_CTX and temporary BIGNUMs t1, t2
-6. If q parameter exists (modern/FIPS parameters):
-   a. Validate generator: 1 < g < p and g^q == 1 mod p
-   b. Verify q is prime via BN_check_prime() [EXPENSIVE O(n³)]
-   c. Verify q divides (p-1) exactly
-   d. If j exists, verify j == (p-1)/q
-7. Verify p is prime via BN_check_prime() [EXPENSIVE O(n³)]
-8. If q not present (legacy parameters without explicit subgroup):
-   a. Compute (p-1)/2
-   b. Verify (p-1)/2 is prime [EXPENSIVE O(n³)] - this makes p a safe prime
-9. Clean up and return success
+1. Refuse the parameters if any component is negative
+2. For each of p, g, q, j in that order, hash a 4-byte big-endian length
+   followed by the big-endian value
+3. An absent component hashes as length 0xFFFFFFFF with no value, so a
+   missing q never collides with q == 0
 
 WHY THIS DESIGN:
-The function has two completely different validation paths:
+Everything DH_check() looks at is in p, g, q and j, so two parameter sets
+with the same fingerprint get the same verdict. The length prefixes make
+the encoding unambiguous, which a plain concatenation would not be.
+BN_bn2bin() drops the sign, so g and -g would hash alike while DH_check()
+rejects -g. No valid parameter set has a negative component, so such sets
+get no fingerprint at all and every caller falls back to a full check.
+
+@note The fingerprint is not secret and not keyed - it identifies values,
+      it does not authenticate them
+@note SHA-256 runs on a stack SHA256_CTX rather than an EVP_MD_CTX, so
+      this allocates nothing; DH_CHECK_HOT fingerprints on every call
+
+@see ossl_dh_check_reload(), ossl_dh_validate_group()
+*/
+int ossl_dh_params_fingerprint(const DH *dh, unsigned char *md)
+{
+    const BIGNUM *bn[4];
+    unsigned char buf[4 + (OPENSSL_DH_MAX_MODULUS_BITS + 7) / 8];
+    SHA256_CTX sha;
+    size_t i, len;
+    int ok = 0;
 
-FIPS MODULE: Relies entirely on FIPS 186-4 validators that use approved algorithms.
-Cannot use general-purpose primality testing due to FIPS restrictions.
+    bn[0] = dh->params.p;
+    bn[1] = dh->params.g;
+    bn[2] = dh->params.q;
+    bn[3] = dh->params.j;
 
-NON-FIPS: Provides comprehensive validation including:
-- Support for both modern parameters (with q) and legacy parameters (without q)
-- Fast-path for known approved groups (no primality testing needed)
-- Full cryptographic validation including multiple primality tests
-- Safe prime verification for parameters without explicit q
+    if (!SHA256_Init(&sha))
+        return 0;
+    for (i = 0; i < OSSL_NELEM(bn); i++) {
+        if (bn[i] == NULL) {
+            memset(buf, 0xff, 4);
+            len = 0;
+        } else {
+            len = (size_t)BN_num_bytes(bn[i]);
+            if (BN_is_negative(bn[i]) || len > sizeof(buf) - 4)
+                goto err;
+            buf[0] = (unsigned char)(len >> 24);
+            buf[1] = (unsigned char)(len >> 16);
+            buf[2] = (unsigned char)(len >> 8);
+            buf[3] = (unsigned char)len;
+            BN_bn2bin(bn[i], buf + 4);
+        }
+        if (!SHA256_Update(&sha, buf, 4 + len))
+            goto err;
+    }
+    ok = 1;
+ err:
+    /* Final also wipes the context */
+    if (!SHA256_Final(md, &sha))
+        ok = 0;
+    return ok;
+}
 
-The split between q-present and q-absent cases exists because:
-- Modern/FIPS parameters include explicit subgroup order q
-- Legacy DH parameters often omit q (security provided by safe prime property)
-- Different mathematical properties must be verified in each case
+#ifndef FIPS_MODULE
+/*
+ * Widely deployed groups that DH_get_nid() does not know, with the flags
+ * DH_check() reports for them. Entries are matched on the values of p, g
+ * and q, never on a digest of them.
+ * Bump DH_KNOWN_GROUPS_VERSION whenever an entry is added or a verdict
+ * changes (e.g. a new DH_check() test), and regenerate the verdicts by
+ * running DH_check() on the groups with this table emptied.
+ * RFC 5114 groups are not listed: they are named groups outside the FIPS
+ * module and never get this far.
+ * Entries narrower than DH_KNOWN_GROUP_MIN_BITS are listed to be refused:
+ * a hit on one also reports DH_MODULUS_TOO_SMALL.
+ */
+#define DH_KNOWN_GROUPS_VERSION 3
+#define DH_KNOWN_GROUP_MIN_BITS 2048
+
+typedef struct dh_known_group_st {
+    int bits;                   /* BN_num_bits(p) */
+    const unsigned char *p;     /* big-endian, bits / 8 bytes */
+    BN_ULONG g;
+    int q_half;                 /* q == (p - 1) / 2, otherwise q absent */
+    int flags;                  /* DH_check() flags */
+} DH_KNOWN_GROUP;
+
+/* RFC 2409 Oakley group 1 */
+static const unsigned char dh_oakley768_p[] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xC9, 0x0F, 0xDA, 0xA2, 0x21, 0x68, 0xC2, 0x34,
+    0xC4, 0xC6, 0x62, 0x8B, 0x80, 0xDC, 0x1C, 0xD1,
+    0x29, 0x02, 0x4E, 0x08, 0x8A, 0x67, 0xCC, 0x74,
+    0x02, 0x0B, 0xBE, 0xA6, 0x3B, 0x13, 0x9B, 0x22,
+    0x51, 0x4A, 0x08, 0x79, 0x8E, 0x34, 0x04, 0xDD,
+    0xEF, 0x95, 0x19, 0xB3, 0xCD, 0x3A, 0x43, 0x1B,
+    0x30, 0x2B, 0x0A, 0x6D, 0xF2, 0x5F, 0x14, 0x37,
+    0x4F, 0xE1, 0x35, 0x6D, 0x6D, 0x51, 0xC2, 0x45,
+    0xE4, 0x85, 0xB5, 0x76, 0x62, 0x5E, 0x7E, 0xC6,
+    0xF4, 0x4C, 0x42, 0xE9, 0xA6, 0x3A, 0x36, 0x20,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
 
-PERFORMANCE CHARACTERISTICS:
-BN_check_prime() calls in this function:
-- With q: 2 primality tests (p and q) [slower]
-- Without q: 2 primality tests (p and (p-1)/2) [slower]
-- Known group: 0 primality tests [fast]
+/*
+ * RFC 2409 Oakley group 2. This is also the group mod_ssl falls back to for
+ * 1024-bit keys when no dhparams are configured (BN_get_rfc2409_prime_1024()).
+ */
+static const unsigned char dh_oakley1024_p[] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xC9, 0x0F, 0xDA, 0xA2, 0x21, 0x68, 0xC2, 0x34,
+    0xC4, 0xC6, 0x62, 0x8B, 0x80, 0xDC, 0x1C, 0xD1,
+    0x29, 0x02, 0x4E, 0x08, 0x8A, 0x67, 0xCC, 0x74,
+    0x02, 0x0B, 0xBE, 0xA6, 0x3B, 0x13, 0x9B, 0x22,
+    0x51, 0x4A, 0x08, 0x79, 0x8E, 0x34, 0x04, 0xDD,
+    0xEF, 0x95, 0x19, 0xB3, 0xCD, 0x3A, 0x43, 0x1B,
+    0x30, 0x2B, 0x0A, 0x6D, 0xF2, 0x5F, 0x14, 0x37,
+    0x4F, 0xE1, 0x35, 0x6D, 0x6D, 0x51, 0xC2, 0x45,
+    0xE4, 0x85, 0xB5, 0x76, 0x62, 0x5E, 0x7E, 0xC6,
+    0xF4, 0x4C, 0x42, 0xE9, 0xA6, 0x37, 0xED, 0x6B,
+    0x0B, 0xFF, 0x5C, 0xB6, 0xF4, 0x06, 0xB7, 0xED,
+    0xEE, 0x38, 0x6B, 0xFB, 0x5A, 0x89, 0x9F, 0xA5,
+    0xAE, 0x9F, 0x24, 0x11, 0x7C, 0x4B, 0x1F, 0xE6,
+    0x49, 0x28, 0x66, 0x51, 0xEC, 0xE6, 0x53, 0x81,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static const DH_KNOWN_GROUP dh_known_groups[] = {
+    { 768, dh_oakley768_p, 2, 0, 0 },
+    { 768, dh_oakley768_p, 2, 1, 0 },
+    { 1024, dh_oakley1024_p, 2, 0, 0 },
+    { 1024, dh_oakley1024_p, 2, 1, 0 },
+};
 
-For 2048-bit parameters:
-- Known group: <1ms
-- Custom parameters: 20-200ms (two O(n³) primality tests)
+/*
+ * Is q == (p - 1) / 2 for the odd big-endian p of len bytes? buf is len
+ * bytes of scratch.
+ */
+static int dh_known_group_q_half(const BIGNUM *q, const unsigned char *p,
+                                 size_t len, unsigned char *buf)
+{
+    size_t i;
+    unsigned char carry = 0;
 
-VALIDATION GUARANTEES:
-Success (return 1, *ret == 0) means:
-- p is prime and properly sized
-- g is a valid generator for the group
-- If q exists: q is prime, q|(p-1), g^q==1 mod p
-- If q absent: p is a safe prime (both p and (p-1)/2 are prime)
-- All parameters suitable for cryptographic use
+    if (BN_is_negative(q) || BN_bn2binpad(q, buf, (int)len) < 0)
+        return 0;
+    for (i = 0; i < len; i++) {
+        if (buf[i] != (unsigned char)(carry | (p[i] >> 1)))
+            return 0;
+        carry = (unsigned char)(p[i] << 7);
+    }
+    return 1;
+}
 
-EDGE CASES:
-- Approved group: Returns 1 immediately, trusts group parameters
-- Allocation failure: Returns 0, *ret may be partially populated
-- Primality test error (r < 0): Returns 0, jumps to cleanup
-- Multiple failures: *ret contains bitwise OR of all failure flags
+/* DH_CHECK_* flags that the DH_CHECK_MASK_* tests in |checks| can report */
+static int dh_check_mask_flags(unsigned int checks)
+{
+    int flags = 0;
+
+    if ((checks & DH_CHECK_MASK_GENERATOR) != 0)
+        flags |= DH_NOT_SUITABLE_GENERATOR;
+    if ((checks & DH_CHECK_MASK_Q_PRIME) != 0)
+        flags |= DH_CHECK_Q_NOT_PRIME;
+    if ((checks & DH_CHECK_MASK_Q_DIVIDES_P) != 0)
+        flags |= DH_CHECK_INVALID_Q_VALUE;
+    if ((checks & DH_CHECK_MASK_J) != 0)
+        flags |= DH_CHECK_INVALID_J_VALUE;
+    if ((checks & DH_CHECK_MASK_P_PRIME) != 0)
+        flags |= DH_CHECK_P_NOT_PRIME;
+    if ((checks & DH_CHECK_MASK_P_SAFE_PRIME) != 0)
+        flags |= DH_CHECK_P_NOT_SAFE_PRIME;
+    return flags;
+}
 
-HISTORICAL CONTEXT:
-Comment says "according to documentation - this only checks the params" but the
-function actually performs FULL validation including primality testing. The comment
-likely refers to the fact that this does not validate public/private keys, only
-the domain parameters (p, g, q, j).
+/**
+@brief Look up precomputed DH_check() verdicts for widely deployed non-named groups
 
-@warning EXTREMELY EXPENSIVE - performs 2-3 primality tests at O(n³) each
-@warning Always call DH_check_params() first to reject invalid sizes
-@warning Known approved groups skip primality testing (trusted parameters)
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] checks DH_CHECK_MASK_* tests the caller asked for
+@param[out] ret DH_check() flags for the group when found
 
-@note FIPS vs non-FIPS: Completely different validation logic
-@note Legacy compatibility: Supports parameters without q via safe prime check
+@return 1 if the parameters are in dh_known_groups[] (*ret is set)
+@retval 0 if they are not
 
-@see DH_check_ex(), DH_check_params(), BN_check_prime()
+@details
+Algorithm Flow (Plain English):
+1. Give up on a negative p or g, or when j is present
+2. Compare bits(p) with the table entries; no match costs nothing more
+3. For an entry of that size, compare g as a word, p byte for byte and q
+   against (p - 1) / 2 or absence
+4. On a hit, report the entry's flags minus those of unselected tests, and
+   DH_MODULUS_TOO_SMALL below DH_KNOWN_GROUP_MIN_BITS
+
+WHY THIS DESIGN:
+Groups such as the RFC 2409 Oakley primes are everywhere in old
+configurations, yet each DH_check() on them repeats the same primality
+tests on p and (p-1)/2. Their verdict never changes, so it is computed once
+and compiled in. The size filter keeps the cost for every other custom
+group at one BN_num_bits().
+
+Matching on the values rather than on ossl_dh_params_fingerprint() keeps the
+table independent of the fingerprint encoding: a hit skips every test, so
+nothing short of equality of p, g and q, signs included, may produce one.
+BN_bn2binpad() and BN_is_word() alone ignore the sign of p and q, hence the
+explicit BN_is_negative() tests.
+
+Every entry today is an Oakley group, and 768 and 1024 bits are too small
+to accept. A hit answers them with DH_MODULUS_TOO_SMALL at the cost of the
+comparison, before any primality test, and DH_check_ex() turns that into
+DH_R_MODULUS_TOO_SMALL. The flag is added here rather than stored in the
+entries, so the entries stay DH_check()'s own verdicts.
+
+@note This is stricter than DH_check() without the table: DH_MIN_MODULUS_BITS
+      is 512, so other custom groups of these sizes still pass. Only groups
+      listed here are refused for their size
+
+@see dh_check_explicit()
 */
-int DH_check(const DH *dh, int *ret)
+static int dh_check_known_group(const DH *dh, unsigned int checks, int *ret)
 {
-#ifdef FIPS_MODULE
-    return DH_check_params(dh, ret);
-#else
-    int ok = 0, r;
-    BN_CTX *ctx = NULL;
-    BIGNUM *t1 = NULL, *t2 = NULL;
-    int nid = DH_get_nid((DH *)dh);
-
-    *ret = 0;
-    /* Known approved group - trust parameters without validation */
-    if (nid != NID_undef)
+    unsigned char buf[1024 / 8];
+    const BIGNUM *p = dh->params.p, *g = dh->params.g, *q = dh->params.q;
+    const DH_KNOWN_GROUP *group;
+    int bits = BN_num_bits(p);
+    size_t i, len;
+
+    if (g == NULL || BN_is_negative(p) || BN_is_negative(g)
+        || dh->params.j != NULL)
+        return 0;
+    for (i = 0; i < OSSL_NELEM(dh_known_groups); i++) {
+        group = &dh_known_groups[i];
+        len = (size_t)group->bits / 8;
+        if (group->bits != bits
+            || !BN_is_word(g, group->g)
+            || group->q_half != (q != NULL)
+            || BN_bn2binpad(p, buf, (int)len) < 0
+            || memcmp(buf, group->p, len) != 0
+            || (q != NULL && !dh_known_group_q_half(q, group->p, len, buf)))
+            continue;
+        *ret = group->flags & ~dh_check_mask_flags(DH_CHECK_MASK_ALL & ~checks);
+        if (group->bits < DH_KNOWN_GROUP_MIN_BITS)
+            *ret |= DH_MODULUS_TOO_SMALL;
         return 1;
+    }
+    return 0;
+}
 
-    /* Basic structural validation first (fast checks) */
-    if (!DH_check_params(dh, ret))
-        return 0;
+/**
+@brief Explicit-check strategy for full DH parameter validation
 
-    ctx = BN_CTX_new_ex(dh->libctx);
-    if (ctx == NULL)
-        goto err;
-    BN_CTX_start(ctx);
-    t1 = BN_CTX_get(ctx);
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] checks Bitwise OR of DH_CHECK_MASK_* values selecting the tests to run
+@param[in] cb Callback passed to every BN_check_prime() call (may be NULL)
+@param[in] ctx BN_CTX to take temporaries from, or NULL to use a private one
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by this function)
+
+@return 1 on success (all checks completed - inspect *ret for failures)
+@retval 0 on failure (allocation error or primality test error)
+
+@details
+This is the NON-FIPS MODULE VERSION described under DH_check(): named group
+bypass, dh_check_params_explicit(), then the q, j, p and safe prime checks.
+It is kept as a separate helper so ossl_dh_check_strategy() can run it
+alongside the FIPS 186-4 regeneration strategy in the same build.
+
+Each expensive test is guarded by its DH_CHECK_MASK_* bit. With
+DH_CHECK_MASK_ALL the sequence of tests is exactly the historical DH_check()
+sequence, so a selected test always reports the same flag full validation
+would have reported.
+
+EDGE CASES:
+- Q_DIVIDES_P and J share one BN_div(); it runs if either is selected
+- P_SAFE_PRIME only reports when p is prime. Selected without P_PRIME, the
+  caller vouches that p is prime (ossl_dh_check_cached() does, from a
+  cached verdict); ossl_dh_check_mask() always adds P_PRIME instead
+
+@warning EXTREMELY EXPENSIVE - performs 2-3 primality tests at O(n³) each
+
+@see DH_check(), ossl_dh_check_strategy(), ossl_dh_check_mask()
+*/
+static int dh_check_explicit(const DH *dh, unsigned int checks, BN_GENCB *cb,
+                             BN_CTX *ctx, int *ret)
+{
+    int ok = 0, r;
+    BN_CTX *new_ctx = NULL;
+    BIGNUM *t1 = NULL, *t2 = NULL;
+    DH_PROF_SAMPLE prof;
+    int nid = DH_get_nid(dh);
+
+    *ret = 0;
+    /* Known approved group - trust parameters without validation */
+    if (nid != NID_undef)
+        return 1;
+    /* Well-known non-named group - the verdict is precomputed */
+    if (dh->params.p != NULL && dh_check_known_group(dh, checks, ret))
+        return 1;
+
+    if (ctx == NULL) {
+        ctx = new_ctx = BN_CTX_new_ex(dh->libctx);
+        if (ctx == NULL)
+            return 0;
+    }
+    /* Basic structural validation first (fast checks), sharing the BN_CTX */
+    if (!dh_check_params_explicit(dh, ctx, ret)) {
+        BN_CTX_free(new_ctx);
+        return 0;
+    }
+
+    BN_CTX_start(ctx);
+    t1 = BN_CTX_get(ctx);
     t2 = BN_CTX_get(ctx);
     if (t2 == NULL)
         goto err;
@@ -863,47 +1579,72 @@ int DH_check(const DH *dh, int *ret)
     /* Modern parameters with explicit subgroup order q */
     if (dh->params.q != NULL) {
         /* Validate generator with respect to q */
-        if (BN_cmp(dh->params.g, BN_value_one()) <= 0)
-            *ret |= DH_NOT_SUITABLE_GENERATOR;
-        else if (BN_cmp(dh->params.g, dh->params.p) >= 0)
-            *ret |= DH_NOT_SUITABLE_GENERATOR;
-        else {
-            /* Check g^q == 1 mod p */
-            if (!BN_mod_exp(t1, dh->params.g, dh->params.q, dh->params.p, ctx))
-                goto err;
-            if (!BN_is_one(t1))
+        if ((checks & DH_CHECK_MASK_GENERATOR) != 0) {
+            if (BN_cmp(dh->params.g, BN_value_one()) <= 0)
+                *ret |= DH_NOT_SUITABLE_GENERATOR;
+            else if (BN_cmp(dh->params.g, dh->params.p) >= 0)
                 *ret |= DH_NOT_SUITABLE_GENERATOR;
+            else {
+                /* Check g^q == 1 mod p */
+                DH_PROF_BEGIN(prof);
+                r = BN_mod_exp(t1, dh->params.g, dh->params.q,
+                               dh->params.p, ctx);
+                DH_PROF_END(prof, DH_CHECK_PROF_GENERATOR, dh);
+                if (!r)
+                    goto err;
+                if (!BN_is_one(t1))
+                    *ret |= DH_NOT_SUITABLE_GENERATOR;
+            }
         }
         /* Verify q is prime [EXPENSIVE O(n³)] */
-        r = BN_check_prime(dh->params.q, ctx, NULL);
+        if ((checks & DH_CHECK_MASK_Q_PRIME) != 0) {
+            DH_PROF_BEGIN(prof);
+            r = BN_check_prime(dh->params.q, ctx, cb);
+            DH_PROF_END(prof, DH_CHECK_PROF_Q_PRIME, dh);
+            if (r < 0)
+                goto err;
+            if (!r)
+                *ret |= DH_CHECK_Q_NOT_PRIME;
+        }
+        if ((checks & (DH_CHECK_MASK_Q_DIVIDES_P | DH_CHECK_MASK_J)) != 0) {
+            /* Check p == 1 mod q  i.e. q divides p - 1 */
+            DH_PROF_BEGIN(prof);
+            r = BN_div(t1, t2, dh->params.p, dh->params.q, ctx);
+            DH_PROF_END(prof, DH_CHECK_PROF_Q_DIVIDES_P, dh);
+            if (!r)
+                goto err;
+            if ((checks & DH_CHECK_MASK_Q_DIVIDES_P) != 0
+                && !BN_is_one(t2))
+                *ret |= DH_CHECK_INVALID_Q_VALUE;
+            /* Verify optional cofactor j == (p-1)/q */
+            if ((checks & DH_CHECK_MASK_J) != 0
+                && dh->params.j != NULL
+                && BN_cmp(dh->params.j, t1))
+                *ret |= DH_CHECK_INVALID_J_VALUE;
+        }
+    }
+
+    if ((checks & DH_CHECK_MASK_P_PRIME) != 0) {
+        /* Verify p is prime [EXPENSIVE O(n³)] */
+        DH_PROF_BEGIN(prof);
+        r = BN_check_prime(dh->params.p, ctx, cb);
+        DH_PROF_END(prof, DH_CHECK_PROF_P_PRIME, dh);
         if (r < 0)
             goto err;
         if (!r)
-            *ret |= DH_CHECK_Q_NOT_PRIME;
-        /* Check p == 1 mod q  i.e. q divides p - 1 */
-        if (!BN_div(t1, t2, dh->params.p, dh->params.q, ctx))
-            goto err;
-        if (!BN_is_one(t2))
-            *ret |= DH_CHECK_INVALID_Q_VALUE;
-        /* Verify optional cofactor j == (p-1)/q */
-        if (dh->params.j != NULL
-            && BN_cmp(dh->params.j, t1))
-            *ret |= DH_CHECK_INVALID_J_VALUE;
+            *ret |= DH_CHECK_P_NOT_PRIME;
     }
-
-    /* Verify p is prime [EXPENSIVE O(n³)] */
-    r = BN_check_prime(dh->params.p, ctx, NULL);
-    if (r < 0)
-        goto err;
-    if (!r)
-        *ret |= DH_CHECK_P_NOT_PRIME;
-    else if (dh->params.q == NULL) {
+    if ((*ret & DH_CHECK_P_NOT_PRIME) == 0
+        && dh->params.q == NULL
+        && (checks & DH_CHECK_MASK_P_SAFE_PRIME) != 0) {
         /* Legacy parameters without q - verify p is a safe prime */
         /* Safe prime: both p and (p-1)/2 must be prime */
         if (!BN_rshift1(t1, dh->params.p))
             goto err;
         /* Verify (p-1)/2 is prime [EXPENSIVE O(n³)] */
-        r = BN_check_prime(t1, ctx, NULL);
+        DH_PROF_BEGIN(prof);
+        r = BN_check_prime(t1, ctx, cb);
+        DH_PROF_END(prof, DH_CHECK_PROF_P_SAFE_PRIME, dh);
         if (r < 0)
             goto err;
         if (!r)
@@ -912,406 +1653,3236 @@ int DH_check(const DH *dh, int *ret)
     ok = 1;
  err:
     BN_CTX_end(ctx);
-    BN_CTX_free(ctx);
+    BN_CTX_free(new_ctx);
     return ok;
-#endif /* FIPS_MODULE */
 }
+#endif /* FIPS_MODULE */
+
+/* Note: according to documentation - this only checks the params */
 
 /**
-@brief Validate DH public key with error reporting via error stack
+@brief Full cryptographic validation of DH parameters (includes expensive primality testing)
 
-@param[in] dh DH parameter structure containing domain parameters (must be initialized, not NULL)
-@param[in] pub_key Public key value to validate (must not be NULL)
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by this function)
 
-@return 1 on success (public key is valid)
-@retval 0 on failure (public key invalid or allocation error, check ERR_get_error())
+@return 1 on success (all validations passed)
+@retval 0 on failure (allocation error during validation - check *ret for specific failures)
 
 @details
 Algorithm Flow (Plain English):
-1. Call DH_check_pub_key() to perform validation and get error flags
-2. For each error flag returned, raise corresponding error on error stack
-3. Return 1 only if no error flags were set
+
+FIPS MODULE VERSION (simpler):
+1. Delegates entirely to DH_check_params() which handles FIPS 186-4 validation
+2. No additional checks performed
+
+NON-FIPS MODULE VERSION (comprehensive):
+1. Initialize *ret = 0
+2. Check if parameters are from known approved group (NID != NID_undef) - if yes, return success immediately
+3. Call DH_check_params() for basic structural validation (p odd, g valid, size bounds)
+4. If basic checks fail, return 0 (don't proceed to expensive checks)
+5. Allocate BN_CTX and temporary BIGNUMs t1, t2
+6. If q parameter exists (modern/FIPS parameters):
+   a. Validate generator: 1 < g < p and g^q == 1 mod p
+   b. Verify q is prime via BN_check_prime() [EXPENSIVE O(n³)]
+   c. Verify q divides (p-1) exactly
+   d. If j exists, verify j == (p-1)/q
+7. Verify p is prime via BN_check_prime() [EXPENSIVE O(n³)]
+8. If q not present (legacy parameters without explicit subgroup):
+   a. Compute (p-1)/2
+   b. Verify (p-1)/2 is prime [EXPENSIVE O(n³)] - this makes p a safe prime
+9. Clean up and return success
 
 WHY THIS DESIGN:
-API wrapper that combines public key validation with error stack management.
-Provides modern error reporting interface for the underlying DH_check_pub_key().
+The function has two completely different validation paths:
 
-VALIDATION PERFORMED (delegated to DH_check_pub_key):
-- Public key is in valid range: 2 <= pub_key <= p-2
-- Additional checks per SP800-56Ar3 Section 5.6.2.3.1
+FIPS MODULE: Relies entirely on FIPS 186-4 validators that use approved algorithms.
+Cannot use general-purpose primality testing due to FIPS restrictions.
 
-SECURITY IMPORTANCE:
-Invalid public keys can lead to:
-- Trivial shared secrets (if pub_key == 1 or pub_key == p-1)
-- Small subgroup attacks (if pub_key not in correct subgroup)
-- Denial of service (if pub_key out of range causes errors later)
+NON-FIPS: Provides comprehensive validation including:
+- Support for both modern parameters (with q) and legacy parameters (without q)
+- Fast-path for known approved groups (no primality testing needed)
+- Full cryptographic validation including multiple primality tests
+- Safe prime verification for parameters without explicit q
+
+The split between q-present and q-absent cases exists because:
+- Modern/FIPS parameters include explicit subgroup order q
+- Legacy DH parameters often omit q (security provided by safe prime property)
+- Different mathematical properties must be verified in each case
+
+PERFORMANCE CHARACTERISTICS:
+BN_check_prime() calls in this function:
+- With q: 2 primality tests (p and q) [slower]
+- Without q: 2 primality tests (p and (p-1)/2) [slower]
+- Known group: 0 primality tests [fast]
+
+For 2048-bit parameters:
+- Known group: <1ms
+- Custom parameters: 20-200ms (two O(n³) primality tests)
+
+VALIDATION GUARANTEES:
+Success (return 1, *ret == 0) means:
+- p is prime and properly sized
+- g is a valid generator for the group
+- If q exists: q is prime, q|(p-1), g^q==1 mod p
+- If q absent: p is a safe prime (both p and (p-1)/2 are prime)
+- All parameters suitable for cryptographic use
 
 EDGE CASES:
-- pub_key too small (<=1): Sets DH_CHECK_PUBKEY_TOO_SMALL
-- pub_key too large (>=p-1): Sets DH_CHECK_PUBKEY_TOO_LARGE  
-- pub_key invalid (other criteria): Sets DH_CHECK_PUBKEY_INVALID
-- Allocation failure: Returns 0
+- Approved group: Returns 1 immediately, trusts group parameters
+- Allocation failure: Returns 0, *ret may be partially populated
+- Primality test error (r < 0): Returns 0, jumps to cleanup
+- Multiple failures: *ret contains bitwise OR of all failure flags
 
-@warning Always validate peer public keys before computing shared secret
-@note This performs full public key validation per SP800-56Ar3
+HISTORICAL CONTEXT:
+Comment says "according to documentation - this only checks the params" but the
+function actually performs FULL validation including primality testing. The comment
+likely refers to the fact that this does not validate public/private keys, only
+the domain parameters (p, g, q, j).
 
-@see DH_check_pub_key(), ossl_ffc_validate_public_key()
+@warning EXTREMELY EXPENSIVE - performs 2-3 primality tests at O(n³) each
+@warning Always call DH_check_params() first to reject invalid sizes
+@warning Known approved groups skip primality testing (trusted parameters)
+
+@note FIPS vs non-FIPS: Completely different validation logic
+@note Legacy compatibility: Supports parameters without q via safe prime check
+
+@see DH_check_ex(), DH_check_params(), BN_check_prime()
 */
-int DH_check_pub_key_ex(const DH *dh, const BIGNUM *pub_key)
+int DH_check(const DH *dh, int *ret)
 {
-    int errflags = 0;
+#ifdef FIPS_MODULE
+    return dh_check_params_fips186_4(dh, ret);
+#else
+    return dh_check_explicit(dh, DH_CHECK_MASK_ALL, NULL, NULL, ret);
+#endif /* FIPS_MODULE */
+}
 
-    if (!DH_check_pub_key(dh, pub_key, &errflags))
-        return 0;
+/**
+@brief Resolve a DH_CHECK_STRATEGY_* selector to the strategy that will run
 
-    if ((errflags & DH_CHECK_PUBKEY_TOO_SMALL) != 0)
-        ERR_raise(ERR_LIB_DH, DH_R_CHECK_PUBKEY_TOO_SMALL);
-    if ((errflags & DH_CHECK_PUBKEY_TOO_LARGE) != 0)
-        ERR_raise(ERR_LIB_DH, DH_R_CHECK_PUBKEY_TOO_LARGE);
-    if ((errflags & DH_CHECK_PUBKEY_INVALID) != 0)
-        ERR_raise(ERR_LIB_DH, DH_R_CHECK_PUBKEY_INVALID);
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] strategy One of the DH_CHECK_STRATEGY_* values
 
-    return errflags == 0;
+@return DH_CHECK_STRATEGY_EXPLICIT or DH_CHECK_STRATEGY_FIPS186_4
+@retval -1 if the selector is unknown or not available in this build
+
+@details
+Algorithm Flow (Plain English):
+1. DEFAULT resolves to what this build's DH_check() runs
+2. PREFER_SEED picks FIPS 186-4 regeneration when the parameters carry a
+   seed and q, and the explicit checks otherwise
+3. EXPLICIT is refused inside the FIPS module (not an approved method)
+
+WHY PREFER_SEED REGENERATES WHEN A SEED IS PRESENT:
+The rule is about assurance, not cost. Regeneration proves p and q were
+derived from the seed and so were not chosen maliciously, which the explicit
+checks cannot. Without a seed it can only fail with
+FFC_CHECK_MISSING_SEED_OR_COUNTER, so the explicit checks are the only
+strategy that can succeed. Which of the two is faster depends on the
+generation counter; dh_check_bench -m reports both for custom groups.
+*/
+static int dh_check_resolve_strategy(const DH *dh, int strategy)
+{
+    switch (strategy) {
+    case DH_CHECK_STRATEGY_DEFAULT:
+#ifdef FIPS_MODULE
+        return DH_CHECK_STRATEGY_FIPS186_4;
+#else
+        return DH_CHECK_STRATEGY_EXPLICIT;
+#endif
+    case DH_CHECK_STRATEGY_PREFER_SEED:
+#ifndef FIPS_MODULE
+        if (dh->params.seed == NULL || dh->params.seedlen == 0
+            || dh->params.q == NULL)
+            return DH_CHECK_STRATEGY_EXPLICIT;
+#endif
+        return DH_CHECK_STRATEGY_FIPS186_4;
+    case DH_CHECK_STRATEGY_FIPS186_4:
+        return DH_CHECK_STRATEGY_FIPS186_4;
+#ifndef FIPS_MODULE
+    case DH_CHECK_STRATEGY_EXPLICIT:
+        return DH_CHECK_STRATEGY_EXPLICIT;
+#endif
+    default:
+        return -1;
+    }
 }
 
-/*
- * See SP800-56Ar3 Section 5.6.2.3.1 : FFC Full public key validation.
- */
+/**
+@brief DH parameter validation with a caller-selected strategy
+
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] strategy One of the DH_CHECK_STRATEGY_* values
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by callee)
+
+@return 1 on success (checks completed - inspect *ret for failures)
+@retval 0 on failure (unknown strategy, allocation error or validation failure)
+
+@details
+Algorithm Flow (Plain English):
+1. Resolve the selector via dh_check_resolve_strategy()
+2. EXPLICIT: run dh_check_params_explicit() (no primality testing)
+3. FIPS186_4: run dh_check_params_fips186_4() (named group or regeneration)
+
+WHY THIS DESIGN:
+DH_check_params() fixes the strategy at compile time. This entry point makes
+both available in a non-FIPS build so callers can choose per call, and so the
+two can be benchmarked against each other on the same binary.
+
+EDGE CASES:
+- Unknown selector: raises ERR_R_PASSED_INVALID_ARGUMENT, returns 0
+- EXPLICIT inside the FIPS module: same as unknown selector
+- FIPS186_4 flags are FFC_* values, EXPLICIT flags are DH_* values
+
+@note The two strategies do not validate the same things: FIPS186_4 proves
+      p and q from the seed (expensive), EXPLICIT only checks structure
+
+@see DH_check_params(), ossl_dh_check_strategy()
+*/
+int ossl_dh_check_params_strategy(const DH *dh, int strategy, int *ret)
+{
+    *ret = 0;
+    switch (dh_check_resolve_strategy(dh, strategy)) {
+#ifndef FIPS_MODULE
+    case DH_CHECK_STRATEGY_EXPLICIT:
+        return dh_check_params_explicit(dh, NULL, ret);
+#endif
+    case DH_CHECK_STRATEGY_FIPS186_4:
+        return dh_check_params_fips186_4(dh, ret);
+    default:
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+}
 
 /**
-@brief Full public key validation per SP800-56Ar3 Section 5.6.2.3.1
+@brief Full DH parameter validation with a caller-selected strategy
 
-@param[in] dh DH parameter structure containing domain parameters (must be initialized, not NULL)
-@param[in] pub_key Public key value to validate (must not be NULL)
-@param[out] ret Pointer to int for validation error flags (initialized by callee)
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] strategy One of the DH_CHECK_STRATEGY_* values
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by callee)
 
-@return 1 on success (public key valid)
-@retval 0 on failure (validation error - check *ret for specific failure)
+@return 1 on success (checks completed - inspect *ret for failures)
+@retval 0 on failure (unknown strategy, allocation error or validation failure)
 
 @details
 Algorithm Flow (Plain English):
-Delegates entirely to ossl_ffc_validate_public_key() which implements:
-1. Verify pub_key is in valid range: 2 <= pub_key <= p-2
-2. If q parameter exists, verify pub_key^q == 1 mod p (subgroup membership)
-3. Additional checks per SP800-56Ar3 requirements
+1. Resolve the selector via dh_check_resolve_strategy()
+2. EXPLICIT: run dh_check_explicit() (the non-FIPS DH_check() path)
+3. FIPS186_4: run dh_check_params_fips186_4() (the FIPS DH_check() path)
 
 WHY THIS DESIGN:
-Thin wrapper around FFC (Finite Field Cryptography) generic public key validator.
-DH public key validation uses same mathematical checks as DSA public key validation,
-so code is shared in the FFC layer.
+Same as ossl_dh_check_params_strategy() but for the full check. With
+DH_CHECK_STRATEGY_PREFER_SEED, parameters that carry a FIPS 186-4 seed are
+verified by regeneration and everything else goes through the explicit
+primality tests.
 
-STANDARDS COMPLIANCE:
-Implements SP800-56Ar3 Section 5.6.2.3.1 "FFC Full public key validation"
-This is the complete validation required for static (long-lived) public keys.
+@warning EXPENSIVE - both strategies perform primality testing on custom groups
 
-VALIDATION GUARANTEES:
-- pub_key is in mathematically valid range for DH computations
-- pub_key is in correct subgroup (if q parameter exists)
-- pub_key will produce valid shared secret when used with DH_compute_key()
+@see DH_check(), ossl_dh_check_params_strategy()
+*/
+int ossl_dh_check_strategy(const DH *dh, int strategy, int *ret)
+{
+    *ret = 0;
+    switch (dh_check_resolve_strategy(dh, strategy)) {
+#ifndef FIPS_MODULE
+    case DH_CHECK_STRATEGY_EXPLICIT:
+        return dh_check_explicit(dh, DH_CHECK_MASK_ALL, NULL, NULL, ret);
+#endif
+    case DH_CHECK_STRATEGY_FIPS186_4:
+        return dh_check_params_fips186_4(dh, ret);
+    default:
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+}
 
-SECURITY IMPORTANCE:
-Full validation protects against:
-- Small subgroup attacks (pub_key in weak subgroup)
-- Invalid curve attacks (pub_key not on valid parameters)
-- Trivial shared secret attacks (pub_key == 1 or p-1)
+#ifndef FIPS_MODULE
+/**
+@brief Full DH parameter validation restricted to caller-selected tests
+
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] checks Bitwise OR of DH_CHECK_MASK_* values selecting the tests to run
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by callee)
+
+@return 1 on success (selected checks completed - inspect *ret for failures)
+@retval 0 on failure (unknown mask bits, allocation error or primality test error)
+
+@details
+Algorithm Flow (Plain English):
+1. Reject mask bits outside DH_CHECK_MASK_ALL
+2. If P_SAFE_PRIME is selected, also select P_PRIME (safe prime implies prime)
+3. Run dh_check_explicit() with the resulting mask
+
+WHY THIS DESIGN:
+DH_check() always pays for every applicable primality test. A caller that has
+already proven q prime elsewhere, or that only needs the safe prime property,
+can drop the tests it does not need. The named group bypass and the cheap
+structural checks of DH_check_params() (odd p, g range, modulus size) always
+run: they cost nothing next to a primality test and keep oversized moduli out
+of BN_check_prime().
+
+VALIDATION GUARANTEES:
+For every selected test, the flag in *ret is exactly what DH_check() would
+report. Flags of tests that were not selected are never set, except for the
+structural flags noted above. DH_CHECK_MASK_ALL is equivalent to DH_check().
 
 EDGE CASES:
-- pub_key == 1: Invalid (trivial shared secret)
-- pub_key == p-1: Invalid (trivial shared secret)  
-- pub_key == 0: Invalid (out of range)
-- pub_key >= p: Invalid (out of range)
-- q exists but pub_key^q != 1 mod p: Invalid (wrong subgroup)
+- checks == 0: only the structural checks run
+- Tests that do not apply (q or j absent) are skipped as in DH_check()
+- Groups in dh_known_groups[] are answered from the table for any mask,
+  including DH_MODULUS_TOO_SMALL for the Oakley groups
+
+@warning A cleared bit means the property was NOT verified - *ret == 0 does not
+         mean the parameters are fully valid
+
+@see DH_check(), dh_check_explicit()
+*/
+int ossl_dh_check_mask(const DH *dh, unsigned int checks, int *ret)
+{
+    *ret = 0;
+    if ((checks & ~DH_CHECK_MASK_ALL) != 0) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+    if ((checks & DH_CHECK_MASK_P_SAFE_PRIME) != 0)
+        checks |= DH_CHECK_MASK_P_PRIME;
+    return dh_check_explicit(dh, checks, NULL, NULL, ret);
+}
+
+/**
+@brief DH_check_params() taking temporaries from a caller-provided BN_CTX
+
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] ctx BN_CTX owned by the caller (not NULL)
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by callee)
+
+@return 1 on success (checks completed - inspect *ret for failures)
+@retval 0 on failure (BN_CTX exhausted or arithmetic error)
+
+@details
+Same checks as the non-FIPS DH_check_params(), but no BN_CTX is created.
+With a BN_CTX that has already served one call of the same modulus size,
+the call makes no heap allocation at all.
+
+ALLOCATION-FREE PROFILE (OPENSSL_DH_CHECK_NO_ALLOC):
+These entry points make no heap allocation, which the internal test checks
+with a counting allocator:
+- DH_check_params() and ossl_dh_check_params_ctx() - in this profile the
+  g < p - 1 test compares bytes on the stack and ctx may be NULL
+- ossl_dh_check_priv_key(), on all three paths: q of a custom group, the
+  length of an approved group, and no q
+- ossl_dh_check_pub_key_partial() - in this profile a byte comparison with
+  p - 2 on the stack instead of ossl_ffc_validate_public_key_partial(),
+  which creates a BN_CTX per call
+- ossl_dh_check_pub_key_partial_batch() and the ossl_dh_pub_key_stream_*()
+  functions
+Without the profile the same holds for all but DH_check_params() and
+ossl_dh_check_pub_key_partial(), given a warmed-up BN_CTX. DH_check(),
+DH_check_pub_key(), the pair-wise checks and every other validation entry
+point that builds on them are not covered - their exponentiations and
+primality tests build Montgomery contexts and exponent tables inside
+crypto/bn. dh_check_local.h declares them with DH_CHECK_ALLOCATES, so in
+this profile calling one is a compile-time error with GCC and Clang. The
+caches, trackers, executor and profiler own heap state by design; only
+their set-up and tear-down functions may be called. Error paths may
+allocate the thread's error queue.
+The buffers on the stack are sized for OPENSSL_DH_MAX_MODULUS_BITS whatever
+the size of p. The internal test runs the entry points above on a painted
+thread stack and requires them to use at most 16 KiB more than an idle
+thread.
+
+@see DH_check_params(), ossl_dh_check_ctx()
+*/
+int ossl_dh_check_params_ctx(const DH *dh, BN_CTX *ctx, int *ret)
+{
+    return dh_check_params_explicit(dh, ctx, ret);
+}
+
+/**
+@brief DH_check() taking temporaries from a caller-provided BN_CTX
+
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] ctx BN_CTX owned by the caller (not NULL)
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by callee)
+
+@return 1 on success (checks completed - inspect *ret for failures)
+@retval 0 on failure (allocation error or primality test error)
+
+@details
+Same checks as the non-FIPS DH_check(). dh_check.c itself allocates
+nothing: the structural checks and the q, j, p and safe prime tests all
+take their temporaries from ctx, so a warmed-up BN_CTX reused across calls
+removes the per-call BN_CTX_new_ex()/BN_CTX_free() pair.
+
+WHAT STILL ALLOCATES:
+BN_check_prime() and BN_mod_exp() build a Montgomery context per call inside
+the bn library. Removing those would need caller-provided BN_MONT_CTX
+support in crypto/bn, so this entry point is outside the
+OPENSSL_DH_CHECK_NO_ALLOC profile (see ossl_dh_check_params_ctx()).
+
+@see DH_check(), ossl_dh_check_params_ctx(), ossl_dh_check_pairwise_ctx()
+*/
+int ossl_dh_check_ctx(const DH *dh, BN_CTX *ctx, int *ret)
+{
+    return dh_check_explicit(dh, DH_CHECK_MASK_ALL, NULL, ctx, ret);
+}
+#endif /* FIPS_MODULE */
+
+#ifndef FIPS_MODULE
+/*
+ * Per-component DH_check() verdicts for one parameter set. Each cached
+ * verdict is tied to copies of the components it was computed from, so a
+ * change to one component only invalidates the tests that depend on it.
+ */
+struct dh_check_cache_st {
+    BIGNUM *p, *q, *g, *j;  /* components the cached verdicts belong to */
+    unsigned int valid;     /* DH_CHECK_MASK_* tests with a cached verdict */
+    int flags;              /* DH_CHECK_* flags reported by the valid tests */
+};
+
+/**
+@brief Allocate an empty DH_check() verdict cache
+
+@return New cache with no valid verdicts
+@retval NULL on allocation failure
+
+@see ossl_dh_check_cached(), ossl_dh_check_cache_free()
+*/
+DH_CHECK_CACHE *ossl_dh_check_cache_new(void)
+{
+    return OPENSSL_zalloc(sizeof(DH_CHECK_CACHE));
+}
+
+/**
+@brief Free a DH_check() verdict cache and its component copies
+
+@param[in] cache Cache to free (NULL is a no-op)
+*/
+void ossl_dh_check_cache_free(DH_CHECK_CACHE *cache)
+{
+    if (cache == NULL)
+        return;
+    BN_free(cache->p);
+    BN_free(cache->q);
+    BN_free(cache->g);
+    BN_free(cache->j);
+    OPENSSL_free(cache);
+}
+
+/* Equality of two optional components, where NULL only equals NULL */
+static int dh_check_cache_bn_eq(const BIGNUM *a, const BIGNUM *b)
+{
+    if (a == NULL || b == NULL)
+        return a == b;
+    return BN_cmp(a, b) == 0;
+}
+
+/* Replace the cached copy of an optional component */
+static int dh_check_cache_bn_set(BIGNUM **dst, const BIGNUM *src)
+{
+    if (src == NULL) {
+        BN_free(*dst);
+        *dst = NULL;
+        return 1;
+    }
+    if (*dst == NULL)
+        return (*dst = BN_dup(src)) != NULL;
+    return BN_copy(*dst, src) != NULL;
+}
+
+/**
+@brief Full DH parameter validation that reuses cached per-component verdicts
+
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in,out] cache Verdict cache from ossl_dh_check_cache_new() (not NULL)
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by callee)
+
+@return 1 on success (checks completed - inspect *ret for failures)
+@retval 0 on failure (allocation error or primality test error)
+
+@details
+Algorithm Flow (Plain English):
+1. Compare p, q, g and j against the copies held in the cache
+2. Work out which tests are stale:
+   a. p changed: every test
+   b. q changed: q prime, q | p-1, j and generator
+   c. q appeared or disappeared: also safe prime, which only applies
+      without q
+   d. j changed: j
+   e. g changed: generator
+3. Run dh_check_explicit() for the stale tests only. A stale safe prime
+   test reuses the cached p primality verdict: it is skipped when p is
+   known not to be prime, and p is not tested again when it is
+4. Merge fresh flags for stale tests with cached flags for the others
+5. Store the new component copies and verdicts in the cache
+
+WHY THIS DESIGN:
+Tenants that rotate generators over a fixed p and q should not repeat the
+BN_check_prime() work on p, q and (p-1)/2 each time. When only g changes,
+step 3 runs just the g range and g^q checks. The result is the same set of
+flags DH_check() would report for the current parameters.
+
+EDGE CASES:
+- Empty cache: everything is stale, this costs the same as DH_check()
+- The p primality verdict depends on p alone and is only recomputed when
+  p changes; a new q value on both sides leaves the safe prime verdict
+  alone too, since that test does not run while q is present
+- Any failure empties the cache so a partial update is never trusted
+
+MEMORY MANAGEMENT:
+The cache owns copies of p, q, g and j (BN_dup/BN_copy), never pointers into
+the DH, so the DH may be freed or modified independently.
+
+@warning NOT thread-safe - use one cache per thread or serialize access
+@warning The cache compares values, not DH identity - it may be shared across
+         DH objects with the same p and q, which is the intended use
+
+@see DH_check(), ossl_dh_check_mask(), dh_check_explicit()
+*/
+int ossl_dh_check_cached(const DH *dh, DH_CHECK_CACHE *cache, int *ret)
+{
+    unsigned int stale = 0, run;
+    int fresh, stale_flags;
+
+    *ret = 0;
+    if (!dh_check_cache_bn_eq(cache->p, dh->params.p))
+        stale |= DH_CHECK_MASK_ALL;
+    if (!dh_check_cache_bn_eq(cache->q, dh->params.q))
+        stale |= DH_CHECK_MASK_Q_PRIME | DH_CHECK_MASK_Q_DIVIDES_P
+                 | DH_CHECK_MASK_J | DH_CHECK_MASK_GENERATOR;
+    if ((cache->q == NULL) != (dh->params.q == NULL))
+        stale |= DH_CHECK_MASK_P_SAFE_PRIME;
+    if (!dh_check_cache_bn_eq(cache->j, dh->params.j))
+        stale |= DH_CHECK_MASK_J;
+    if (!dh_check_cache_bn_eq(cache->g, dh->params.g))
+        stale |= DH_CHECK_MASK_GENERATOR;
+    stale |= DH_CHECK_MASK_ALL & ~cache->valid;
+
+    /* A safe prime test on its own trusts the cached p primality verdict */
+    run = stale;
+    if ((run & DH_CHECK_MASK_P_PRIME) == 0
+        && (cache->flags & DH_CHECK_P_NOT_PRIME) != 0)
+        run &= ~DH_CHECK_MASK_P_SAFE_PRIME;
+    if (!dh_check_explicit(dh, run, NULL, NULL, &fresh))
+        goto err;
+
+    if (!dh_check_cache_bn_set(&cache->p, dh->params.p)
+        || !dh_check_cache_bn_set(&cache->q, dh->params.q)
+        || !dh_check_cache_bn_set(&cache->g, dh->params.g)
+        || !dh_check_cache_bn_set(&cache->j, dh->params.j))
+        goto err;
+
+    stale_flags = dh_check_mask_flags(stale);
+    cache->flags = (cache->flags & ~stale_flags) | (fresh & stale_flags);
+    cache->valid = DH_CHECK_MASK_ALL;
+    *ret = fresh | cache->flags;
+    return 1;
+ err:
+    cache->valid = 0;
+    cache->flags = 0;
+    return 0;
+}
+#endif /* FIPS_MODULE */
+
+#ifndef FIPS_MODULE
+/*
+ * BN_GENCB callback for the primality tests: BN_check_prime() calls it after
+ * every Miller-Rabin round. Inside an ASYNC_JOB this hands control back to
+ * whoever called ASYNC_start_job(); outside one it does nothing.
+ */
+static int dh_check_async_yield(int a, int b, BN_GENCB *cb)
+{
+    if (ASYNC_get_current_job() != NULL && !ASYNC_pause_job())
+        return 0;
+    return 1;
+}
+
+/**
+@brief Full DH parameter validation that yields between primality test rounds
+
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by callee)
+
+@return 1 on success (checks completed - inspect *ret for failures)
+@retval 0 on failure (allocation error or primality test error)
+
+@details
+Algorithm Flow (Plain English):
+1. Set up a BN_GENCB around dh_check_async_yield()
+2. Run dh_check_explicit() with every test selected and that callback
+3. Each Miller-Rabin round of each BN_check_prime() call may pause the
+   surrounding ASYNC_JOB
+
+WHY THIS DESIGN:
+ASYNC_JOB is libcrypto's coroutine mechanism. A reactor thread can run this
+inside ASYNC_start_job() and get ASYNC_PAUSE back after every primality
+round, so one large custom group does not block the reactor for the whole
+DH_check(). The ASYNC_start_job() loop maps directly onto a C++ coroutine
+awaiter. Outside an ASYNC_JOB the callback does nothing and the result is
+identical to DH_check().
+
+@note Only the primality tests yield; the single g^q exponentiation does not
+@warning The DH must stay alive and unmodified until the job completes
+
+@see DH_check(), ASYNC_start_job(), ossl_dh_check_job_submit()
+*/
+int ossl_dh_check_async(const DH *dh, int *ret)
+{
+    BN_GENCB *cb;
+    int ok;
+
+    *ret = 0;
+    if ((cb = BN_GENCB_new()) == NULL)
+        return 0;
+    BN_GENCB_set(cb, dh_check_async_yield, NULL);
+    ok = dh_check_explicit(dh, DH_CHECK_MASK_ALL, cb, NULL, ret);
+    BN_GENCB_free(cb);
+    return ok;
+}
+#endif /* FIPS_MODULE */
+
+/**
+@brief Validate DH public key with error reporting via error stack
+
+@param[in] dh DH parameter structure containing domain parameters (must be initialized, not NULL)
+@param[in] pub_key Public key value to validate (must not be NULL)
+
+@return 1 on success (public key is valid)
+@retval 0 on failure (public key invalid or allocation error, check ERR_get_error())
+
+@details
+Algorithm Flow (Plain English):
+1. Call DH_check_pub_key() to perform validation and get error flags
+2. For each error flag returned, raise corresponding error on error stack
+3. Return 1 only if no error flags were set
+
+WHY THIS DESIGN:
+API wrapper that combines public key validation with error stack management.
+Provides modern error reporting interface for the underlying DH_check_pub_key().
+
+VALIDATION PERFORMED (delegated to DH_check_pub_key):
+- Public key is in valid range: 2 <= pub_key <= p-2
+- Additional checks per SP800-56Ar3 Section 5.6.2.3.1
+
+SECURITY IMPORTANCE:
+Invalid public keys can lead to:
+- Trivial shared secrets (if pub_key == 1 or pub_key == p-1)
+- Small subgroup attacks (if pub_key not in correct subgroup)
+- Denial of service (if pub_key out of range causes errors later)
+
+EDGE CASES:
+- pub_key too small (<=1): Sets DH_CHECK_PUBKEY_TOO_SMALL
+- pub_key too large (>=p-1): Sets DH_CHECK_PUBKEY_TOO_LARGE  
+- pub_key invalid (other criteria): Sets DH_CHECK_PUBKEY_INVALID
+- Allocation failure: Returns 0
+
+@warning Always validate peer public keys before computing shared secret
+@note This performs full public key validation per SP800-56Ar3
+
+@see DH_check_pub_key(), ossl_ffc_validate_public_key()
+*/
+int DH_check_pub_key_ex(const DH *dh, const BIGNUM *pub_key)
+{
+    int errflags = 0;
+
+    if (!DH_check_pub_key(dh, pub_key, &errflags))
+        return 0;
+
+    if ((errflags & DH_CHECK_PUBKEY_TOO_SMALL) != 0)
+        ERR_raise(ERR_LIB_DH, DH_R_CHECK_PUBKEY_TOO_SMALL);
+    if ((errflags & DH_CHECK_PUBKEY_TOO_LARGE) != 0)
+        ERR_raise(ERR_LIB_DH, DH_R_CHECK_PUBKEY_TOO_LARGE);
+    if ((errflags & DH_CHECK_PUBKEY_INVALID) != 0)
+        ERR_raise(ERR_LIB_DH, DH_R_CHECK_PUBKEY_INVALID);
+
+    return errflags == 0;
+}
+
+/*
+ * See SP800-56Ar3 Section 5.6.2.3.1 : FFC Full public key validation.
+ */
+
+/**
+@brief Full public key validation per SP800-56Ar3 Section 5.6.2.3.1
+
+@param[in] dh DH parameter structure containing domain parameters (must be initialized, not NULL)
+@param[in] pub_key Public key value to validate (must not be NULL)
+@param[out] ret Pointer to int for validation error flags (initialized by callee)
+
+@return 1 on success (public key valid)
+@retval 0 on failure (validation error - check *ret for specific failure)
+
+@details
+Algorithm Flow (Plain English):
+Delegates entirely to ossl_ffc_validate_public_key() which implements:
+1. Verify pub_key is in valid range: 2 <= pub_key <= p-2
+2. If q parameter exists, verify pub_key^q == 1 mod p (subgroup membership)
+3. Additional checks per SP800-56Ar3 requirements
+
+WHY THIS DESIGN:
+Thin wrapper around FFC (Finite Field Cryptography) generic public key validator.
+DH public key validation uses same mathematical checks as DSA public key validation,
+so code is shared in the FFC layer.
+
+STANDARDS COMPLIANCE:
+Implements SP800-56Ar3 Section 5.6.2.3.1 "FFC Full public key validation"
+This is the complete validation required for static (long-lived) public keys.
+
+VALIDATION GUARANTEES:
+- pub_key is in mathematically valid range for DH computations
+- pub_key is in correct subgroup (if q parameter exists)
+- pub_key will produce valid shared secret when used with DH_compute_key()
+
+SECURITY IMPORTANCE:
+Full validation protects against:
+- Small subgroup attacks (pub_key in weak subgroup)
+- Invalid curve attacks (pub_key not on valid parameters)
+- Trivial shared secret attacks (pub_key == 1 or p-1)
+
+EDGE CASES:
+- pub_key == 1: Invalid (trivial shared secret)
+- pub_key == p-1: Invalid (trivial shared secret)  
+- pub_key == 0: Invalid (out of range)
+- pub_key >= p: Invalid (out of range)
+- q exists but pub_key^q != 1 mod p: Invalid (wrong subgroup)
+
+@note Use ossl_dh_check_pub_key_partial() for ephemeral keys (faster)
+@note Full validation is expensive - cache result if validating same key multiple times
+
+@see ossl_dh_check_pub_key_partial(), ossl_ffc_validate_public_key()
+*/
+int DH_check_pub_key(const DH *dh, const BIGNUM *pub_key, int *ret)
+{
+    DH_PROF_SAMPLE prof;
+    int ok;
+
+    DH_PROF_BEGIN(prof);
+    ok = ossl_ffc_validate_public_key(&dh->params, pub_key, ret);
+    DH_PROF_END(prof, DH_CHECK_PROF_PUB_KEY, dh);
+    return ok;
+}
+
+/*
+ * See SP800-56Ar3 Section 5.6.2.3.1 : FFC Partial public key validation.
+ * To only be used with ephemeral FFC public keys generated using the approved
+ * safe-prime groups.
+ */
+
+/*
+ * Write p - 2 as |keylen| big-endian bytes to |bound|, which holds at least
+ * OPENSSL_DH_MAX_MODULUS_BITS bits. Fails if p is missing or <= 2, or does
+ * not fit in |keylen| bytes.
+ */
+static int dh_pub_key_bound(const DH *dh, size_t keylen, unsigned char *bound)
+{
+    if (dh->params.p == NULL
+        || keylen == 0
+        || keylen > (OPENSSL_DH_MAX_MODULUS_BITS + 7) / 8
+        || !dh_p_minus_bytes(dh->params.p, 2, bound, keylen)) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+    return 1;
+}
+
+#if defined(OPENSSL_DH_CHECK_NO_ALLOC) || !defined(FIPS_MODULE)
+/*
+ * 2 <= pub_key <= p - 2, with the same flags as
+ * ossl_ffc_validate_public_key_partial() but without its BN_CTX: the upper
+ * bound is compared as big-endian bytes on the stack. Fails for p wider than
+ * OPENSSL_DH_MAX_MODULUS_BITS.
+ */
+static int dh_check_pub_key_range(const DH *dh, const BIGNUM *pub_key,
+                                  int *ret)
+{
+    unsigned char bound[(OPENSSL_DH_MAX_MODULUS_BITS + 7) / 8];
+    unsigned char key[(OPENSSL_DH_MAX_MODULUS_BITS + 7) / 8];
+    size_t keylen;
+
+    *ret = 0;
+    if (dh->params.p == NULL || pub_key == NULL) {
+        *ret = FFC_ERROR_PASSED_NULL_PARAM;
+        return 0;
+    }
+    if (BN_cmp(pub_key, BN_value_one()) <= 0) {
+        *ret |= FFC_ERROR_PUBKEY_TOO_SMALL;
+        return 0;
+    }
+    if (BN_cmp(pub_key, dh->params.p) >= 0) {
+        *ret |= FFC_ERROR_PUBKEY_TOO_LARGE;
+        return 0;
+    }
+    keylen = BN_num_bytes(dh->params.p);
+    if (!dh_pub_key_bound(dh, keylen, bound)
+        || BN_bn2binpad(pub_key, key, (int)keylen) < 0)
+        return 0;
+    if (memcmp(key, bound, keylen) > 0) {
+        *ret |= FFC_ERROR_PUBKEY_TOO_LARGE;
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+/**
+@brief Partial public key validation for ephemeral keys (faster, safe-prime groups only)
+
+@param[in] dh DH parameter structure with safe-prime group parameters (must be initialized, not NULL)
+@param[in] pub_key Ephemeral public key value to validate (must not be NULL)
+@param[out] ret Pointer to int for validation error flags (initialized by callee)
+
+@return 1 on success (public key valid for ephemeral use)
+@retval 0 on failure (validation error - check *ret for specific failure)
+
+@details
+Algorithm Flow (Plain English):
+Delegates to ossl_ffc_validate_public_key_partial() which implements:
+1. Verify pub_key is in valid range: 2 <= pub_key <= p-2
+2. Skip expensive subgroup membership test (g^q == 1 mod p)
+3. Rely on safe-prime group properties for security
+
+WHY THIS DESIGN:
+SP800-56Ar3 Section 5.6.2.3.1 allows "partial" validation for ephemeral public keys
+when using approved safe-prime groups (RFC 7919 groups ffdhe2048, ffdhe3072, etc.).
+
+Safe-prime groups have mathematical properties that make the expensive subgroup
+membership test (pub_key^q == 1 mod p) unnecessary:
+- All non-identity elements generate the full group
+- No small subgroups exist
+- Simple range check is sufficient
+
+PERFORMANCE BENEFIT:
+Full validation: O(n³) for subgroup test
+Partial validation: O(1) range check only
+Speedup: 100-1000x faster for ephemeral key validation
+
+WHEN TO USE:
+- Ephemeral (single-use) DH keys in TLS, SSH, IKE
+- Parameters from approved safe-prime groups (RFC 7919)
+- Performance-critical key exchange
+
+WHEN NOT TO USE:
+- Static (long-term) public keys → use DH_check_pub_key()
+- Custom (non-approved) parameter groups → use DH_check_pub_key()
+- FIPS compliance with explicit validation requirements → use DH_check_pub_key()
+
+SECURITY GUARANTEE:
+For approved safe-prime groups, partial validation provides equivalent security
+to full validation but with dramatically better performance.
+
+EDGE CASES:
+- pub_key <= 1: Invalid (trivial)
+- pub_key >= p-1: Invalid (trivial)
+- Non-safe-prime group: Results undefined (caller must ensure safe-prime group)
+
+@warning Only use with approved safe-prime groups (RFC 7919)
+@warning Do NOT use for static/long-term public keys
+@note With OPENSSL_DH_CHECK_NO_ALLOC the range check is done on stack bytes
+      and fails for p wider than OPENSSL_DH_MAX_MODULUS_BITS
+
+@see DH_check_pub_key(), ossl_ffc_validate_public_key_partial()
+*/
+int ossl_dh_check_pub_key_partial(const DH *dh, const BIGNUM *pub_key, int *ret)
+{
+#ifdef OPENSSL_DH_CHECK_NO_ALLOC
+    return dh_check_pub_key_range(dh, pub_key, ret);
+#else
+    return ossl_ffc_validate_public_key_partial(&dh->params, pub_key, ret);
+#endif
+}
+
+/**
+@brief Partial validation of a batch of fixed-width ephemeral public keys
+
+@param[in] dh DH parameter structure with safe-prime group parameters (must be initialized, not NULL)
+@param[in] keys nkeys big-endian public keys, each exactly keylen bytes, stored back to back
+@param[in] keylen Width of every key in bytes (BN_num_bytes(p) <= keylen <= max modulus bytes)
+@param[in] nkeys Number of keys in the batch
+@param[out] flags nkeys bytes, one per key: 0, DH_CHECK_PUBKEY_TOO_SMALL or DH_CHECK_PUBKEY_TOO_LARGE
+
+@return 1 on success (every key was classified - inspect flags[])
+@retval 0 on failure (missing p or unsupported keylen)
+
+@details
+Algorithm Flow (Plain English):
+1. Encode p as keylen big-endian bytes in a stack buffer
+2. Subtract 2 from that byte string to get the upper bound p-2
+3. For each key:
+   a. OR together all bytes except the last: if zero and last byte <= 1,
+      the key is <= 1 (DH_CHECK_PUBKEY_TOO_SMALL)
+   b. Otherwise compare with p-2 via memcmp(): greater means the key is
+      >= p-1 (DH_CHECK_PUBKEY_TOO_LARGE)
+   c. Otherwise the key is in [2, p-2] (flag 0)
+
+WHY THIS DESIGN:
+High-rate ephemeral FFDHE otherwise calls ossl_dh_check_pub_key_partial()
+once per key, each with its own BIGNUM. Fixed-width big-endian keys compare
+in numeric order as byte strings, so the range check needs no BIGNUM at all:
+one OR-reduction and one memcmp() per key, with the bound computed once per
+batch. Both loops are plain byte loops that compilers and libc vectorize,
+which keeps this portable C (explicit SIMD lives in the perlasm modules).
+
+VALIDATION GUARANTEES:
+flags[i] is the same flag ossl_dh_check_pub_key_partial() would report for
+BN_bin2bn(keys + i * keylen, keylen). ossl_ffc_validate_public_key_partial()
+stops at the first failure, so at most one flag is set per key.
+
+EDGE CASES:
+- nkeys == 0: returns 1 without touching flags
+- keylen wider than p: leading zero bytes are fine, non-zero ones make the
+  key too large as expected
+- p <= 1: rejected as invalid (no valid range exists)
+
+@warning Only use with approved safe-prime groups, exactly like
+         ossl_dh_check_pub_key_partial()
+@note Keys are public - the comparisons are not constant time
+
+@see ossl_dh_check_pub_key_partial()
+*/
+int ossl_dh_check_pub_key_partial_batch(const DH *dh,
+                                        const unsigned char *keys,
+                                        size_t keylen, size_t nkeys,
+                                        unsigned char *flags)
+{
+    unsigned char bound[(OPENSSL_DH_MAX_MODULUS_BITS + 7) / 8];
+    const unsigned char *key;
+    unsigned char acc;
+    size_t i, j;
+
+    if (!dh_pub_key_bound(dh, keylen, bound))
+        return 0;
+
+    for (i = 0, key = keys; i < nkeys; i++, key += keylen) {
+        acc = 0;
+        for (j = 0; j < keylen - 1; j++)
+            acc |= key[j];
+        if (acc == 0 && key[keylen - 1] <= 1)
+            flags[i] = DH_CHECK_PUBKEY_TOO_SMALL;
+        else if (memcmp(key, bound, keylen) > 0)
+            flags[i] = DH_CHECK_PUBKEY_TOO_LARGE;
+        else
+            flags[i] = 0;
+    }
+    return 1;
+}
+
+/**
+@brief Start an incremental range check of a public key that arrives in pieces
+
+@param[out] st Caller-owned stream state (not NULL)
+@param[in] dh DH parameter structure with safe-prime group parameters (must be initialized, not NULL)
+@param[in] keylen Total length of the big-endian key on the wire
+           (BN_num_bytes(p) <= keylen <= max modulus bytes)
+
+@return 1 on success
+@retval 0 on failure (missing p or unsupported keylen)
+
+@details
+Algorithm Flow (Plain English):
+1. Encode p - 2 as keylen big-endian bytes, as in
+   ossl_dh_check_pub_key_partial_batch()
+2. ossl_dh_pub_key_stream_feed() compares each arriving byte with the same
+   position of p - 2 until the first difference, which settles the upper
+   bound: a larger byte rejects the key at once as too large
+3. ossl_dh_pub_key_stream_final() settles the lower bound (key <= 1), which
+   needs the last byte
+
+WHY THIS DESIGN:
+Streaming front-ends used to collect the whole key, convert it to a BIGNUM
+and only then call ossl_dh_check_pub_key_partial(). Big-endian keys compare
+most significant byte first, so the comparison state fits in a few fields.
+An out-of-range key is dropped after the first differing byte, usually the
+first one, and an accepted key needs no copy.
+
+@note p - 2 is the only buffer; the key bytes are never copied
+@note A too-small key (0 or 1) cannot be told from a valid one before the last byte
+
+@see ossl_dh_pub_key_stream_feed(), ossl_dh_pub_key_stream_final()
+*/
+int ossl_dh_pub_key_stream_init(DH_PUB_KEY_STREAM *st, const DH *dh,
+                                size_t keylen)
+{
+    memset(st, 0, sizeof(*st));
+    if (!dh_pub_key_bound(dh, keylen, st->bound))
+        return 0;
+    st->keylen = keylen;
+    return 1;
+}
+
+/**
+@brief Feed the next bytes of a public key to an incremental range check
+
+@param[in,out] st Stream state from ossl_dh_pub_key_stream_init() (not NULL)
+@param[in] in Next inlen bytes of the big-endian key
+@param[in] inlen Number of bytes (may be 0)
+@param[out] ret Pointer to int for validation error flags (initialized by callee)
+
+@return 1 if the key may still be valid
+@retval 0 if the key is rejected (*ret has DH_CHECK_PUBKEY_TOO_LARGE) or more
+        than keylen bytes were fed
+
+@details
+Once a key is rejected every later call returns 0 with the same flags, so
+the caller may stop reading or drain the rest of the message.
+*/
+int ossl_dh_pub_key_stream_feed(DH_PUB_KEY_STREAM *st, const unsigned char *in,
+                                size_t inlen, int *ret)
+{
+    size_t i;
+
+    *ret = st->flags;
+    if (st->flags != 0)
+        return 0;
+    if (inlen > st->keylen - st->pos) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+    for (i = 0; i < inlen; i++, st->pos++) {
+        if (st->cmp == 0 && in[i] != st->bound[st->pos]) {
+            st->cmp = in[i] > st->bound[st->pos] ? 1 : -1;
+            if (st->cmp > 0) {
+                *ret = st->flags = DH_CHECK_PUBKEY_TOO_LARGE;
+                return 0;
+            }
+        }
+        if (st->pos == st->keylen - 1)
+            st->last = in[i];
+        else
+            st->nonzero |= in[i] != 0;
+    }
+    return 1;
+}
+
+/**
+@brief Finish an incremental range check once the last key byte has arrived
+
+@param[in,out] st Stream state from ossl_dh_pub_key_stream_init() (not NULL)
+@param[out] ret Pointer to int for validation error flags (initialized by callee)
+
+@return 1 if the key is in [2, p-2]
+@retval 0 if it is not (*ret says why) or fewer than keylen bytes were fed
+
+@details
+The result is the one ossl_dh_check_pub_key_partial() gives for the same
+bytes: DH_CHECK_PUBKEY_TOO_SMALL for 0 and 1, DH_CHECK_PUBKEY_TOO_LARGE
+for p - 1 and above.
+
+@warning Only use with approved safe-prime groups, exactly like
+         ossl_dh_check_pub_key_partial()
+*/
+int ossl_dh_pub_key_stream_final(DH_PUB_KEY_STREAM *st, int *ret)
+{
+    *ret = st->flags;
+    if (st->flags != 0)
+        return 0;
+    if (st->pos != st->keylen) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+    if (!st->nonzero && st->last <= 1) {
+        *ret = st->flags = DH_CHECK_PUBKEY_TOO_SMALL;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+@brief Public key validation at the cheapest level SP800-56Ar3 allows for the usage
+
+@param[in] dh DH parameter structure containing domain parameters (must be initialized, not NULL)
+@param[in] pub_key Public key value to validate (must not be NULL)
+@param[in] usage DH_KEY_USAGE_EPHEMERAL or DH_KEY_USAGE_STATIC
+@param[out] level Validation level applied, DH_PUBKEY_CHECK_PARTIAL or
+            DH_PUBKEY_CHECK_FULL (may be NULL)
+@param[out] ret Pointer to int for validation error flags (initialized by callee)
+
+@return 1 on success (public key valid at the applied level)
+@retval 0 on failure (unknown usage, validation error - check *ret)
+
+@details
+Algorithm Flow (Plain English):
+1. Reject unknown usage hints
+2. Partial validation is allowed only if ALL of these hold:
+   a. the key is ephemeral
+   b. the parameters are a named group (DH_get_nid() != NID_undef)
+   c. the named group is a safe-prime group, i.e. q == (p-1)/2, which for a
+      named group shows as bits(q) == bits(p) - 1
+3. If allowed: ossl_dh_check_pub_key_partial() (range check only)
+4. Otherwise: DH_check_pub_key() (range check plus pub_key^q == 1 mod p)
+5. Report the level that was applied through *level
+
+WHY THIS DESIGN:
+Callers used to pick between ossl_dh_check_pub_key_partial() and
+DH_check_pub_key() themselves, and many always paid for the full pub^q mod p
+exponentiation even when partial validation was compliant. This entry point
+makes the choice from the usage hint and the group, and records it so callers
+can log or audit which level was used.
+
+WHY THE SAFE-PRIME TEST IN STEP 2c:
+Outside the FIPS module the named groups include the RFC 5114 groups, whose q
+is a short (160-256 bit) prime. Those are not safe-prime groups, and partial
+validation would miss small-subgroup keys, so they always get full validation.
+
+EDGE CASES:
+- Static key in an approved group: full validation (SP800-56Ar3 requires it)
+- Ephemeral key in a custom group: full validation
+- Named group without q: full validation (cannot confirm the group structure)
+
+@note Partial validation is ~100-1000x cheaper than full validation
+
+@see ossl_dh_check_pub_key_partial(), DH_check_pub_key()
+*/
+int ossl_dh_check_pub_key_policy(const DH *dh, const BIGNUM *pub_key,
+                                 int usage, int *level, int *ret)
+{
+    int partial = 0;
+
+    if (usage != DH_KEY_USAGE_EPHEMERAL && usage != DH_KEY_USAGE_STATIC) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+    if (usage == DH_KEY_USAGE_EPHEMERAL
+        && DH_get_nid(dh) != NID_undef
+        && dh->params.q != NULL
+        && BN_num_bits(dh->params.q) == BN_num_bits(dh->params.p) - 1)
+        partial = 1;
+
+    if (level != NULL)
+        *level = partial ? DH_PUBKEY_CHECK_PARTIAL : DH_PUBKEY_CHECK_FULL;
+    if (partial)
+        return ossl_dh_check_pub_key_partial(dh, pub_key, ret);
+    return DH_check_pub_key(dh, pub_key, ret);
+}
+
+/* A validated DH together with the fingerprint of what DH_check() saw */
+struct dh_validated_group_st {
+    DH *dh;
+    unsigned char fingerprint[DH_PARAMS_FINGERPRINT_LEN];
+};
+
+/**
+@brief Validate DH parameters once and return a handle that records it
+
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[out] ret Pointer to int for DH_check() error flags (initialized by callee)
+
+@return Validated group handle, which takes over the caller's reference to dh
+@retval NULL if DH_check() failed or reported any flag, or the handle could
+        not be allocated (caller keeps dh)
+
+@details
+Algorithm Flow (Plain English):
+1. Run DH_check() on the parameters
+2. If it failed or set any flag, return NULL and leave dh with the caller
+3. Otherwise return a handle holding dh and the ossl_dh_params_fingerprint()
+   of the parameters that were checked
+
+WHY THIS DESIGN:
+Layered callers re-run DH_check() defensively because a plain DH says nothing
+about whether it was checked. A function that takes a
+const DH_VALIDATED_GROUP * has compile-time proof that the group passed
+DH_check(), so it can drop its own re-validation. The type alone cannot stop
+someone who kept the raw DH pointer from calling DH_set0_pqg() on it, so the
+handle also records the fingerprint of the checked values.
+ossl_dh_validated_group_get0_dh() and ossl_dh_validated_pub_key_get0()
+recompute it and refuse a group whose values changed, which costs one
+SHA-256 over p, g, q and j - far less than the DH_check() it stands in for.
+The handle is one small allocation next to the DH.
+
+OWNERSHIP ("move" semantics, like the set0 functions):
+- Success: the caller's reference to dh now belongs to the handle; release it
+  with ossl_dh_validated_group_free(), never DH_free() on the original pointer
+- Failure: nothing is transferred, the caller still owns dh
+
+@warning Do not modify the DH behind a handle (e.g. DH_set0_pqg()) - the
+         handle stops handing it out, with DH_R_BAD_FFC_PARAMETERS
+
+@see ossl_dh_validate_pub_key(), ossl_dh_validated_group_get0_dh(),
+     ossl_dh_validated_group_free()
+*/
+DH_VALIDATED_GROUP *ossl_dh_validate_group(DH *dh, int *ret)
+{
+    DH_VALIDATED_GROUP *group;
+
+    if (!DH_check(dh, ret) || *ret != 0)
+        return NULL;
+    if ((group = OPENSSL_malloc(sizeof(*group))) == NULL)
+        return NULL;
+    if (!ossl_dh_params_fingerprint(dh, group->fingerprint)) {
+        OPENSSL_free(group);
+        return NULL;
+    }
+    group->dh = dh;
+    return group;
+}
+
+/* 1 if the values behind |group| are still the ones that were validated */
+static int dh_validated_group_unchanged(const DH_VALIDATED_GROUP *group)
+{
+    unsigned char fingerprint[DH_PARAMS_FINGERPRINT_LEN];
+
+    if (!ossl_dh_params_fingerprint(group->dh, fingerprint)
+        || memcmp(fingerprint, group->fingerprint, sizeof(fingerprint)) != 0) {
+        ERR_raise(ERR_LIB_DH, DH_R_BAD_FFC_PARAMETERS);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+@brief Access the parameters behind a validated group handle
+
+@param[in] group Validated group handle (not NULL)
+
+@return The validated DH, still owned by the handle
+@retval NULL if its p, g, q or j changed since validation
+*/
+const DH *ossl_dh_validated_group_get0_dh(const DH_VALIDATED_GROUP *group)
+{
+    return dh_validated_group_unchanged(group) ? group->dh : NULL;
+}
+
+/**
+@brief Release a validated group handle and the DH reference it owns
+
+@param[in] group Validated group handle (NULL is a no-op)
+*/
+void ossl_dh_validated_group_free(DH_VALIDATED_GROUP *group)
+{
+    if (group == NULL)
+        return;
+    DH_free(group->dh);
+    OPENSSL_free(group);
+}
+
+/* A public key together with what it was validated against and how */
+struct dh_validated_pubkey_st {
+    BIGNUM *pub_key;
+    unsigned char group[DH_PARAMS_FINGERPRINT_LEN]; /* fingerprint */
+    int level;                      /* DH_PUBKEY_CHECK_PARTIAL or _FULL */
+};
+
+/**
+@brief Validate a public key against a validated group and return a handle that records it
+
+@param[in] group Validated group handle from ossl_dh_validate_group() (not NULL)
+@param[in] pub_key Public key to validate (not NULL)
+@param[in] usage DH_KEY_USAGE_EPHEMERAL or DH_KEY_USAGE_STATIC
+@param[out] ret Pointer to int for validation error flags (initialized by callee)
+
+@return Validated key handle, which takes ownership of pub_key
+@retval NULL if the group changed since validation, validation failed or
+        reported any flag, or the handle could not be allocated (caller keeps
+        pub_key)
+
+@details
+Algorithm Flow (Plain English):
+1. Run ossl_dh_check_pub_key_policy() against the group's parameters, which
+   applies partial or full validation as the usage allows
+2. If it failed or set any flag, return NULL and leave pub_key with the caller
+3. Otherwise return a handle holding pub_key, the group's fingerprint and
+   the level applied
+
+WHY THIS DESIGN:
+Same type-state idea as ossl_dh_validate_group(). Requiring a validated
+group means the group checks are never repeated to validate a key. An
+ephemeral key in a safe-prime named group only gets partial validation,
+which is not a substitute for DH_check_pub_key(), and a key is only valid
+for the parameter values it was checked against. The handle therefore
+records the level and the group's fingerprint rather than its address, so
+a group freed and another allocated at the same address does not match,
+while a second handle for the same values does.
+ossl_dh_validated_pub_key_get0() hands the key out only when both match
+what the consumer needs.
+
+OWNERSHIP: as for ossl_dh_validate_group() - on success pub_key belongs to
+the handle (release with ossl_dh_validated_pub_key_free()); on failure the
+caller still owns it. The handle does not refer to the group after this
+call returns.
+
+@see ossl_dh_validate_group(), ossl_dh_check_pub_key_policy(),
+     ossl_dh_validated_pub_key_get0()
+*/
+DH_VALIDATED_PUBKEY *ossl_dh_validate_pub_key(const DH_VALIDATED_GROUP *group,
+                                              BIGNUM *pub_key, int usage,
+                                              int *ret)
+{
+    DH_VALIDATED_PUBKEY *key;
+    const DH *dh;
+    int level;
+
+    *ret = 0;
+    if ((dh = ossl_dh_validated_group_get0_dh(group)) == NULL
+        || !ossl_dh_check_pub_key_policy(dh, pub_key, usage, &level, ret)
+        || *ret != 0)
+        return NULL;
+    if ((key = OPENSSL_malloc(sizeof(*key))) == NULL)
+        return NULL;
+    key->pub_key = pub_key;
+    memcpy(key->group, group->fingerprint, sizeof(key->group));
+    key->level = level;
+    return key;
+}
+
+/**
+@brief Access the public key behind a validated key handle
+
+@param[in] key Validated key handle (not NULL)
+@param[in] group Group the consumer is about to use the key with (not NULL)
+@param[in] min_level DH_PUBKEY_CHECK_PARTIAL or DH_PUBKEY_CHECK_FULL
+
+@return The validated public key, still owned by the handle
+@retval NULL if the key was validated against other parameter values, or at
+        a lower level than min_level, or the group changed since it was
+        validated - the caller must validate the key itself
+
+@details
+Pass DH_PUBKEY_CHECK_FULL wherever the key stands in for a
+DH_check_pub_key() call; DH_PUBKEY_CHECK_PARTIAL only where SP800-56Ar3
+allows partial validation, i.e. for ephemeral keys in safe-prime groups.
+*/
+const BIGNUM *ossl_dh_validated_pub_key_get0(const DH_VALIDATED_PUBKEY *key,
+                                             const DH_VALIDATED_GROUP *group,
+                                             int min_level)
+{
+    if (!dh_validated_group_unchanged(group))
+        return NULL;
+    if (memcmp(key->group, group->fingerprint, sizeof(key->group)) != 0
+        || key->level < min_level) {
+        ERR_raise(ERR_LIB_DH, DH_R_INVALID_PUBKEY);
+        return NULL;
+    }
+    return key->pub_key;
+}
+
+/**
+@brief Release a validated key handle and the BIGNUM it owns
+
+@param[in] key Validated key handle (NULL is a no-op)
+*/
+void ossl_dh_validated_pub_key_free(DH_VALIDATED_PUBKEY *key)
+{
+    if (key == NULL)
+        return;
+    BN_free(key->pub_key);
+    OPENSSL_free(key);
+}
+
+/**
+@brief Validate DH private key is in correct range
+
+@param[in] dh DH parameter structure containing domain parameters (must be initialized, not NULL)
+@param[in] priv_key Private key value to validate (must not be NULL)
+@param[out] ret Pointer to int for validation error flags (initialized to 0 by this function)
+
+@return 1 on success (private key valid)
+@retval 0 on failure (allocation error or private key out of range)
+
+@details
+Algorithm Flow (Plain English):
+1. Initialize *ret = 0
+2. Determine upper bound for private key validation:
+   a. If q exists: upper = q (standard case)
+   b. If q missing but p exists (non-FIPS only): use bit-length based validation
+   c. If q from approved group AND dh->length set: upper = min(2^length, q)
+3. Validate private key is in range [1, upper-1]; for upper = 2^length this
+   is a bit count, so 2^length is never materialised as a BIGNUM
+
+WHY THIS DESIGN:
+Private key validation has three different paths to handle different parameter scenarios:
+
+PATH 1 (Standard, q exists): 
+- Private key must be in [1, q-1]
+- This is the cryptographically correct range for modern DH
+
+PATH 2 (Legacy, no q, non-FIPS only):
+- No explicit subgroup order available
+- Fall back to bit-length validation
+- If dh->length set: private key must have exactly that many bits
+- If dh->length not set: private key must be in [2, p-2] with reasonable bit length
+
+PATH 3 (Approved group with length restriction):
+- Some approved groups specify shorter private key lengths for performance
+- Validate against min(2^dh->length, q) to enforce both security and spec
+
+VALIDATION GUARANTEES:
+Success means private key is:
+- Non-zero (not the identity)
+- Less than the group order (in proper range)
+- Has appropriate bit length (if length constraint exists)
+
+EDGE CASES:
+- priv_key == 0: Invalid (identity element, no security)
+- priv_key >= q: Invalid (out of subgroup range)
+- priv_key >= p (when q missing): Invalid (out of total range)
+- Negative dh->length on an approved group: Returns 0
+- No q and no p: Returns 0 (cannot validate)
+
+NON-FIPS SPECIAL CASE:
+Lines 261-285 handle legacy parameters without q parameter.
+This is a compatibility feature - modern code should always use parameters with q.
+The bit-length based validation provides basic sanity checking but is not
+cryptographically rigorous.
+
+APPROVED GROUP OPTIMIZATION:
+When using approved safe-prime groups with specified private key length,
+we validate against 2^length rather than full q. This allows shorter
+private keys (e.g., 256 bits instead of 2048 bits) for performance while
+maintaining security. 2^length < q exactly when bits(q) > length (if q is
+2^length the two bounds are equal anyway), and priv_key < 2^length exactly
+when bits(priv_key) <= length, so the check needs no heap allocation.
+
+@warning Non-FIPS path allows validation without q (legacy compatibility)
+@warning Validation without q uses heuristic bit-length checks, not rigorous math
+
+@see ossl_ffc_validate_private_key(), DH_generate_key()
+*/
+int ossl_dh_check_priv_key(const DH *dh, const BIGNUM *priv_key, int *ret)
+{
+    *ret = 0;
+
+    if (dh->params.q != NULL) {
+        /* Is it from an approved Safe prime group ?*/
+        if (DH_get_nid(dh) != NID_undef && dh->length != 0) {
+            /* BN_lshift() rejected negative lengths here before */
+            if (dh->length < 0)
+                return 0;
+            /* Approved group with length restriction: [1, 2^length - 1] */
+            if (BN_num_bits(dh->params.q) > dh->length) {
+                if (BN_cmp(priv_key, BN_value_one()) < 0) {
+                    *ret |= FFC_ERROR_PRIVKEY_TOO_SMALL;
+                    return 0;
+                }
+                if (BN_num_bits(priv_key) > dh->length) {
+                    *ret |= FFC_ERROR_PRIVKEY_TOO_LARGE;
+                    return 0;
+                }
+                return 1;
+            }
+        }
+        /* Validate private key is in [1, q-1] */
+        return ossl_ffc_validate_private_key(dh->params.q, priv_key, ret);
+#ifndef FIPS_MODULE
+    } else if (dh->params.p != NULL) {
+        /*
+         * We do not have q so we just check the key is within some
+         * reasonable range, or the number of bits is equal to dh->length.
+         */
+        int length = dh->length;
+
+        if (length == 0) {
+            /* No length specified - validate bit count is reasonable */
+            length = BN_num_bits(dh->params.p) - 1;
+            if (BN_num_bits(priv_key) <= length
+                && BN_num_bits(priv_key) > 1)
+                return 1;
+        } else if (BN_num_bits(priv_key) == length) {
+            /* Length specified - validate exact bit count */
+            return 1;
+        }
+        return 0;
+#endif
+    }
+    /* No q and no p (or FIPS mode without q) - cannot validate */
+    return 0;
+}
+
+/**
+@brief ossl_dh_check_pairwise() taking temporaries from a caller-provided BN_CTX
+
+@param[in] dh DH structure with both public and private keys set (all fields must be non-NULL)
+@param[in] ctx BN_CTX owned by the caller, or NULL to use a private one
+
+@return 1 on success (key pair is consistent)
+@retval 0 on failure (keys are inconsistent, allocation error, or missing parameters)
+
+@details
+g^priv mod p is recomputed with a Montgomery context owned by this call
+instead of ossl_dh_generate_public_key(), which caches one in
+dh->method_mont_p under dh->lock and so writes the DH being checked. With
+the built-in DH_METHOD the exponentiation is BN_mod_exp_mont_consttime();
+any other method's bn_mod_exp() is called with a BN_FLG_CONSTTIME view of
+the private key, as ossl_dh_generate_public_key() would, so an ENGINE still
+sees the exponentiation.
+
+The recalculated public key comes from the BN_CTX rather than BN_new().
+The Montgomery context, and the exponentiation itself for large moduli,
+still allocate.
+
+@see ossl_dh_check_pairwise(), ossl_dh_check_pairwise_hot()
+*/
+int ossl_dh_check_pairwise_ctx(const DH *dh, BN_CTX *ctx)
+{
+    int ret = 0;
+    BN_CTX *new_ctx = NULL;
+    BN_MONT_CTX *mont = NULL;
+    BIGNUM *pub_key, *prk = NULL;
+    DH_PROF_SAMPLE prof;
+
+    if (dh->params.p == NULL
+        || dh->params.g == NULL
+        || dh->priv_key == NULL
+        || dh->pub_key == NULL)
+        return 0;
+
+    if (ctx == NULL) {
+        ctx = new_ctx = BN_CTX_new_ex(dh->libctx);
+        if (ctx == NULL)
+            return 0;
+    }
+    BN_CTX_start(ctx);
+    pub_key = BN_CTX_get(ctx);
+    if (pub_key == NULL
+        || (mont = BN_MONT_CTX_new()) == NULL
+        || !BN_MONT_CTX_set(mont, dh->params.p, ctx))
+        goto err;
+
+    /* recalculate the public key = (g ^ priv) mod p */
+    DH_PROF_BEGIN(prof);
+    if (dh->meth == DH_OpenSSL()) {
+        ret = BN_mod_exp_mont_consttime(pub_key, dh->params.g, dh->priv_key,
+                                        dh->params.p, ctx, mont);
+    } else if ((prk = BN_new()) != NULL) {
+        BN_with_flags(prk, dh->priv_key, BN_FLG_CONSTTIME);
+        ret = dh->meth->bn_mod_exp(dh, pub_key, dh->params.g, prk,
+                                   dh->params.p, ctx, mont);
+    }
+    DH_PROF_END(prof, DH_CHECK_PROF_PAIRWISE, dh);
+    if (!ret)
+        goto err;
+    /* check it matches the existing pubic_key */
+    ret = BN_cmp(pub_key, dh->pub_key) == 0;
+err:
+    BN_free(prk);
+    BN_MONT_CTX_free(mont);
+    BN_CTX_end(ctx);
+    BN_CTX_free(new_ctx);
+    return ret;
+}
+
+/*
+ * FFC pairwise check from SP800-56A R3.
+ *    Section 5.6.2.1.4 Owner Assurance of Pair-wise Consistency
+ */
+
+/**
+@brief Verify DH public/private key pair consistency
+
+@param[in] dh DH structure with both public and private keys set (all fields must be non-NULL)
+
+@return 1 on success (key pair is consistent)
+@retval 0 on failure (keys are inconsistent, allocation error, or missing parameters)
+
+@details
+Algorithm Flow (Plain English):
+1. Verify all required parameters exist (p, g, priv_key, pub_key)
+2. Take the recalculated public key from a BN_CTX (see ossl_dh_check_pairwise_ctx())
+3. Recalculate public key from private key: pub_calc = g^priv_key mod p
+4. Compare recalculated public key with stored public key
+5. Return 1 if they match (keys are consistent), 0 otherwise
+6. Clean up allocated resources
+
+WHY THIS DESIGN:
+SP800-56A R3 Section 5.6.2.1.4 requires "Owner Assurance of Pair-wise Consistency"
+to verify that a public/private key pair is mathematically consistent before use.
+
+This prevents:
+- Using corrupted key material (memory corruption, disk errors)
+- Using mismatched public/private keys (configuration errors)
+- Using keys generated with faulty random number generators
+- Certain implementation attacks where keys are manipulated
+
+The check is simple: if pub_key was correctly generated from priv_key using the
+DH formula (g^priv mod p), then recalculating it should yield the same result.
+
+WHEN TO USE:
+- After loading keys from storage (detect corruption)
+- After key generation (detect RNG failures)
+- Before using keys for sensitive operations (paranoid validation)
+- FIPS compliance may require this check
+
+PERFORMANCE:
+Modular exponentiation (g^priv mod p) is moderately expensive:
+- O(n²) to O(n³) depending on exponent size
+- For 2048-bit DH: 1-10ms on modern hardware
+- Much faster than primality testing, but not trivial
+
+EDGE CASES:
+- Missing p, g, priv_key, or pub_key: Returns 0 immediately
+- Allocation failure (ctx or pub_key): Returns 0
+- Recalculation failure (Montgomery setup or exponentiation): Returns 0
+- Keys match: Returns 1
+- Keys don't match: Returns 0
+
+SECURITY NOTE:
+This does NOT validate that keys are cryptographically strong, only that they
+are mathematically consistent with each other. You still need DH_check(),
+DH_check_pub_key(), and ossl_dh_check_priv_key() for full security validation.
+
+@warning Does NOT validate cryptographic strength, only mathematical consistency
+@warning All parameters (p, g, priv_key, pub_key) must be non-NULL
+
+@see ossl_dh_check_pairwise_ctx(), SP800-56A R3 Section 5.6.2.1.4
+*/
+int ossl_dh_check_pairwise(const DH *dh)
+{
+    return ossl_dh_check_pairwise_ctx(dh, NULL);
+}
+
+#ifndef FIPS_MODULE
+/**
+@brief Prepare a validation job for ossl_dh_check_job_submit()
+
+@param[out] job Caller-owned job to initialise (not NULL)
+@param[in] type DH_CHECK_JOB_PARAMS, DH_CHECK_JOB_PUB_KEY or DH_CHECK_JOB_PAIRWISE
+@param[in] dh Parameters (and for PAIRWISE, the key pair) to check (not NULL)
+@param[in] pub_key Public key for DH_CHECK_JOB_PUB_KEY, NULL otherwise
+@param[in] done Completion callback, called on the executor thread (may be NULL)
+@param[in] done_arg Passed to done unchanged
+
+@note dh and pub_key are borrowed - keep them alive until done has run
+*/
+void ossl_dh_check_job_init(DH_CHECK_JOB *job, int type, const DH *dh,
+                            const BIGNUM *pub_key,
+                            DH_CHECK_JOB_DONE_FN *done, void *done_arg)
+{
+    memset(job, 0, sizeof(*job));
+    job->type = type;
+    job->dh = dh;
+    job->pub_key = pub_key;
+    job->done = done;
+    job->done_arg = done_arg;
+}
+
+/* Executor entry point: run the check, store the result, signal completion */
+static void dh_check_job_run(void *arg)
+{
+    DH_CHECK_JOB *job = arg;
+
+    switch (job->type) {
+    case DH_CHECK_JOB_PARAMS:
+        job->ok = ossl_dh_check_async(job->dh, &job->flags);
+        break;
+    case DH_CHECK_JOB_PUB_KEY:
+        job->ok = DH_check_pub_key(job->dh, job->pub_key, &job->flags);
+        break;
+    case DH_CHECK_JOB_PAIRWISE:
+        job->ok = ossl_dh_check_pairwise(job->dh);
+        break;
+    default:
+        job->ok = 0;
+        break;
+    }
+    if (job->done != NULL)
+        job->done(job, job->done_arg);
+}
+
+/**
+@brief Hand an expensive validation to a caller-supplied executor
+
+@param[in,out] job Job prepared by ossl_dh_check_job_init() (not NULL)
+@param[in] executor Function that arranges for run(run_arg) to be called,
+           typically on a worker thread; NULL runs the job inline
+@param[in] executor_arg Passed to executor unchanged
+
+@return 1 if the job was run or accepted by the executor
+@retval 0 if the executor refused it (done will NOT be called)
+
+@details
+Algorithm Flow (Plain English):
+1. Unknown job type: raise ERR_R_PASSED_INVALID_ARGUMENT and return 0
+2. No executor: run the job on the calling thread
+3. Otherwise give dh_check_job_run() and the job to the executor
+4. When the executor runs it, the check result is stored in the job and
+   job->done is called on the executor thread
+
+WHY THIS DESIGN:
+DH_check(), full DH_check_pub_key() and ossl_dh_check_pairwise() are the
+expensive calls. This moves them off reactor threads without the library
+owning threads: the executor is a single function pointer, so a thread pool,
+an io_uring loop or a C++ sender/receiver scheduler can be plugged in. A C++
+awaitable implements await_suspend() as a submit whose done callback resumes
+the coroutine handle, and await_resume() as ossl_dh_check_job_result().
+Parameter checks run through ossl_dh_check_async(), so an executor that
+runs jobs inside ASYNC_JOBs can also interleave them.
+
+EDGE CASES:
+- The executor may run the job before submit returns (inline executors)
+- Errors raised on the executor thread stay on that thread's error stack
+
+@warning The job, dh and pub_key must stay alive until done has run
+
+@see ossl_dh_check_job_init(), ossl_dh_check_job_result(), ossl_dh_check_async()
+*/
+int ossl_dh_check_job_submit(DH_CHECK_JOB *job, DH_CHECK_EXECUTOR_FN *executor,
+                             void *executor_arg)
+{
+    if (job->type != DH_CHECK_JOB_PARAMS
+        && job->type != DH_CHECK_JOB_PUB_KEY
+        && job->type != DH_CHECK_JOB_PAIRWISE) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+    if (executor == NULL) {
+        dh_check_job_run(job);
+        return 1;
+    }
+    return executor(dh_check_job_run, job, executor_arg);
+}
+
+/**
+@brief Collect the result of a completed validation job
+
+@param[in] job Job whose done callback has run (not NULL)
+@param[out] ret Error flags of the check (0 for DH_CHECK_JOB_PAIRWISE) (may be NULL)
+
+@return The return value of the underlying check function
+*/
+int ossl_dh_check_job_result(const DH_CHECK_JOB *job, int *ret)
+{
+    if (ret != NULL)
+        *ret = job->flags;
+    return job->ok;
+}
+#endif /* FIPS_MODULE */
+
+#ifdef DH_CHECK_EXECUTOR_PTHREADS
+/*
+ * Dedicated validation executor: a fixed set of worker threads, optionally
+ * pinned to a CPU set and run at a lower priority, fed from one FIFO queue.
+ * The CRYPTO_THREAD_* layer has locks but no threads or condition variables,
+ * so the executor uses pthreads directly, like threads_pthread.c.
+ */
+# define DH_CHECK_EXECUTOR_MAX_CPUS    1024
+typedef struct dh_check_executor_item_st {
+    void (*run)(void *);
+    void *run_arg;
+    uint64_t submitted_us;
+    struct dh_check_executor_item_st *next;
+} DH_CHECK_EXECUTOR_ITEM;
+
+struct dh_check_executor_st {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* signalled when the queue gains an item */
+    pthread_cond_t finished;    /* broadcast when any item completes */
+    DH_CHECK_EXECUTOR_ITEM *head, *tail;
+    int stopping;
+    pthread_t *threads;
+    unsigned int nthreads;
+    unsigned int nstarted;      /* workers that have tried their placement */
+    int place_errno;            /* first placement failure, 0 if none */
+    const char *place_call;     /* the call that failed */
+    unsigned long cpumask[DH_CHECK_EXECUTOR_MAX_CPUS / (8 * sizeof(unsigned long))];
+    int pin;                    /* cpumask is set */
+    int nice;
+    DH_CHECK_EXECUTOR_STATS stats;
+};
+
+/* Synchronous submission: the waiter sleeps on |finished| until |done| */
+typedef struct dh_check_executor_wait_st {
+    DH_CHECK_EXECUTOR *executor;
+    DH_CHECK_JOB *job;
+    int done;
+} DH_CHECK_EXECUTOR_WAIT;
+
+static uint64_t dh_check_executor_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/*
+ * Pin the calling worker to the configured CPUs and apply its nice value.
+ * Returns 0 and sets |*call| on failure, with errno from the failed call.
+ */
+static int dh_check_executor_place_thread(const DH_CHECK_EXECUTOR *executor,
+                                          const char **call)
+{
+# ifdef DH_CHECK_EXECUTOR_PLACEMENT
+    /* pid 0 is the calling thread */
+    if (executor->pin
+        && syscall(SYS_sched_setaffinity, 0, sizeof(executor->cpumask),
+                   executor->cpumask) != 0) {
+        *call = "sched_setaffinity()";
+        return 0;
+    }
+    /* On Linux the nice value is per thread when addressed by thread id */
+    if (executor->nice != 0
+        && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid),
+                       executor->nice) != 0) {
+        *call = "setpriority()";
+        return 0;
+    }
+# endif
+    return 1;
+}
+
+static void *dh_check_executor_worker(void *arg)
+{
+    DH_CHECK_EXECUTOR *executor = arg;
+    DH_CHECK_EXECUTOR_ITEM *item;
+    uint64_t wait_us;
+    const char *call = NULL;
+    int placed, err;
+
+    placed = dh_check_executor_place_thread(executor, &call);
+    err = errno;
+    /* Report to ossl_dh_check_executor_new(), which waits on |finished| */
+    pthread_mutex_lock(&executor->lock);
+    if (!placed && executor->place_errno == 0) {
+        executor->place_errno = err != 0 ? err : EINVAL;
+        executor->place_call = call;
+    }
+    executor->nstarted++;
+    pthread_cond_broadcast(&executor->finished);
+    for (;;) {
+        while (executor->head == NULL && !executor->stopping)
+            pthread_cond_wait(&executor->work, &executor->lock);
+        /* Drain the queue before stopping so every done callback runs */
+        if ((item = executor->head) == NULL)
+            break;
+        if ((executor->head = item->next) == NULL)
+            executor->tail = NULL;
+        executor->stats.queue_depth--;
+        wait_us = dh_check_executor_now_us() - item->submitted_us;
+        executor->stats.total_wait_us += wait_us;
+        if (wait_us > executor->stats.max_wait_us)
+            executor->stats.max_wait_us = wait_us;
+        pthread_mutex_unlock(&executor->lock);
+
+        item->run(item->run_arg);
+        OPENSSL_free(item);
+
+        pthread_mutex_lock(&executor->lock);
+        executor->stats.completed++;
+        pthread_cond_broadcast(&executor->finished);
+    }
+    pthread_mutex_unlock(&executor->lock);
+    return NULL;
+}
+
+/**
+@brief Stop an executor after running every queued job, and free it
+
+@param[in] executor Executor to free (NULL is a no-op)
+
+@warning Must not be called from one of the executor's own workers
+*/
+void ossl_dh_check_executor_free(DH_CHECK_EXECUTOR *executor)
+{
+    unsigned int i;
+
+    if (executor == NULL)
+        return;
+    pthread_mutex_lock(&executor->lock);
+    executor->stopping = 1;
+    pthread_cond_broadcast(&executor->work);
+    pthread_mutex_unlock(&executor->lock);
+    for (i = 0; i < executor->nthreads; i++)
+        pthread_join(executor->threads[i], NULL);
+
+    pthread_cond_destroy(&executor->finished);
+    pthread_cond_destroy(&executor->work);
+    pthread_mutex_destroy(&executor->lock);
+    OPENSSL_free(executor->threads);
+    OPENSSL_free(executor);
+}
+
+/**
+@brief Create a dedicated executor for expensive DH validation work
+
+@param[in] nthreads Number of worker threads (at least 1)
+@param[in] cpus CPU indices the workers may run on (NULL for no affinity)
+@param[in] ncpus Number of entries in cpus
+@param[in] nice Nice value for the workers (0 leaves the priority unchanged)
+
+@return New executor with its workers running
+@retval NULL on allocation or thread creation failure, when affinity or
+        priority were requested on a platform that cannot apply them, or
+        when a worker could not apply them (ERR_LIB_SYS with the errno)
+
+@details
+Algorithm Flow (Plain English):
+1. Validate the configuration and turn the CPU list into an affinity mask
+2. Initialise the queue lock and condition variables
+3. Start nthreads workers; each pins itself to the CPU set, applies the nice
+   value and reports the outcome, then loops taking jobs from the FIFO queue
+4. Wait until every worker has reported; if any placement failed, stop the
+   workers and fail
+
+WHY THIS DESIGN:
+DH_check() and full DH_check_pub_key() otherwise run on whichever thread
+calls them, so one large custom group delays every connection on that core.
+Routing them through ossl_dh_check_executor_run() confines that load to the
+designated cores at a lower priority, and the executor keeps queue-depth and
+wait-time statistics (ossl_dh_check_executor_get_stats()) so the confinement
+can be sized. ossl_dh_check_executor_submit() matches DH_CHECK_EXECUTOR_FN,
+so the same executor also serves ossl_dh_check_job_submit().
+
+PLATFORM SUPPORT:
+Needs POSIX threads. CPU affinity and per-thread nice values are only applied
+on Linux (DH_CHECK_EXECUTOR_PLACEMENT); elsewhere, asking for them fails
+rather than silently running the work on every core.
+
+@warning Workers are real threads - free the executor before the library is
+         unloaded
+@note Placement is all or nothing: a CPU set with no CPU the process may run
+      on, or a negative nice value without privilege, makes this fail
+
+@see ossl_dh_check_executor_run(), ossl_dh_check_executor_free()
+*/
+DH_CHECK_EXECUTOR *ossl_dh_check_executor_new(unsigned int nthreads,
+                                              const int *cpus, size_t ncpus,
+                                              int nice)
+{
+    DH_CHECK_EXECUTOR *executor;
+    const size_t wbits = 8 * sizeof(executor->cpumask[0]);
+    size_t i;
+
+    if (nthreads == 0 || (ncpus > 0 && cpus == NULL)) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return NULL;
+    }
+# ifndef DH_CHECK_EXECUTOR_PLACEMENT
+    if (ncpus > 0 || nice != 0) {
+        ERR_raise(ERR_LIB_DH, ERR_R_UNSUPPORTED);
+        return NULL;
+    }
+# endif
+    for (i = 0; i < ncpus; i++) {
+        if (cpus[i] < 0 || cpus[i] >= DH_CHECK_EXECUTOR_MAX_CPUS) {
+            ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+            return NULL;
+        }
+    }
+
+    if ((executor = OPENSSL_zalloc(sizeof(*executor))) == NULL)
+        return NULL;
+    executor->nice = nice;
+    for (i = 0; i < ncpus; i++)
+        executor->cpumask[cpus[i] / wbits] |= 1UL << (cpus[i] % wbits);
+    executor->pin = ncpus > 0;
+    executor->threads = OPENSSL_zalloc(nthreads * sizeof(*executor->threads));
+    if (executor->threads == NULL)
+        goto err_free;
+    if (pthread_mutex_init(&executor->lock, NULL) != 0)
+        goto err_free;
+    if (pthread_cond_init(&executor->work, NULL) != 0)
+        goto err_lock;
+    if (pthread_cond_init(&executor->finished, NULL) != 0)
+        goto err_work;
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&executor->threads[i], NULL,
+                           dh_check_executor_worker, executor) != 0)
+            break;
+        executor->nthreads++;
+    }
+    if (executor->nthreads != nthreads) {
+        ERR_raise(ERR_LIB_DH, ERR_R_INTERNAL_ERROR);
+        ossl_dh_check_executor_free(executor);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&executor->lock);
+    while (executor->nstarted < executor->nthreads)
+        pthread_cond_wait(&executor->finished, &executor->lock);
+    pthread_mutex_unlock(&executor->lock);
+    if (executor->place_errno != 0) {
+        ERR_raise_data(ERR_LIB_SYS, executor->place_errno, "calling %s",
+                       executor->place_call);
+        ossl_dh_check_executor_free(executor);
+        return NULL;
+    }
+    return executor;
+
+ err_work:
+    pthread_cond_destroy(&executor->work);
+ err_lock:
+    pthread_mutex_destroy(&executor->lock);
+ err_free:
+    OPENSSL_free(executor->threads);
+    OPENSSL_free(executor);
+    return NULL;
+}
+
+/**
+@brief Queue work on a dedicated executor (a DH_CHECK_EXECUTOR_FN)
+
+@param[in] run Function a worker will call
+@param[in] run_arg Passed to run unchanged
+@param[in] executor_arg The DH_CHECK_EXECUTOR (not NULL)
+
+@return 1 if the work was queued
+@retval 0 on allocation failure or if the executor is stopping
+
+@see ossl_dh_check_job_submit()
+*/
+int ossl_dh_check_executor_submit(void (*run)(void *), void *run_arg,
+                                  void *executor_arg)
+{
+    DH_CHECK_EXECUTOR *executor = executor_arg;
+    DH_CHECK_EXECUTOR_ITEM *item;
+
+    if ((item = OPENSSL_zalloc(sizeof(*item))) == NULL)
+        return 0;
+    item->run = run;
+    item->run_arg = run_arg;
+    item->submitted_us = dh_check_executor_now_us();
+
+    pthread_mutex_lock(&executor->lock);
+    if (executor->stopping) {
+        pthread_mutex_unlock(&executor->lock);
+        OPENSSL_free(item);
+        return 0;
+    }
+    if (executor->tail != NULL)
+        executor->tail->next = item;
+    else
+        executor->head = item;
+    executor->tail = item;
+    if (++executor->stats.queue_depth > executor->stats.max_queue_depth)
+        executor->stats.max_queue_depth = executor->stats.queue_depth;
+    pthread_cond_signal(&executor->work);
+    pthread_mutex_unlock(&executor->lock);
+    return 1;
+}
+
+/* Worker side of ossl_dh_check_executor_run(): run the job, wake the waiter */
+static void dh_check_executor_wait_run(void *arg)
+{
+    DH_CHECK_EXECUTOR_WAIT *wait = arg;
+
+    dh_check_job_run(wait->job);
+    pthread_mutex_lock(&wait->executor->lock);
+    wait->done = 1;
+    pthread_mutex_unlock(&wait->executor->lock);
+}
+
+/**
+@brief Run a validation job on a dedicated executor and wait for its result
+
+@param[in] executor Executor from ossl_dh_check_executor_new() (not NULL)
+@param[in,out] job Job prepared by ossl_dh_check_job_init() (not NULL)
+@param[out] ret Error flags of the check (may be NULL)
+
+@return The return value of the underlying check function
+@retval 0 also if the job could not be queued
+
+@details
+Algorithm Flow (Plain English):
+1. Queue the job with a wrapper that marks it done after dh_check_job_run()
+2. Sleep on the executor's completion condition until the wrapper has run
+3. Return the result through ossl_dh_check_job_result()
+
+WHY THIS DESIGN:
+Handshake threads that need the verdict before continuing still block, but
+the exponentiations and primality tests run on the executor's cores. The
+job's own done callback, if any, still runs on the worker first.
+
+@warning Must not be called from one of the executor's own workers
+
+@see ossl_dh_check_executor_new(), ossl_dh_check_job_submit()
+*/
+int ossl_dh_check_executor_run(DH_CHECK_EXECUTOR *executor, DH_CHECK_JOB *job,
+                               int *ret)
+{
+    DH_CHECK_EXECUTOR_WAIT wait;
+
+    wait.executor = executor;
+    wait.job = job;
+    wait.done = 0;
+    if (!ossl_dh_check_executor_submit(dh_check_executor_wait_run, &wait,
+                                       executor))
+        return 0;
+    pthread_mutex_lock(&executor->lock);
+    while (!wait.done)
+        pthread_cond_wait(&executor->finished, &executor->lock);
+    pthread_mutex_unlock(&executor->lock);
+    return ossl_dh_check_job_result(job, ret);
+}
+
+/* One ossl_dh_check_executor_run_batch() call, and one job within it */
+typedef struct dh_check_executor_batch_st {
+    DH_CHECK_EXECUTOR *executor;
+    size_t remaining;
+} DH_CHECK_EXECUTOR_BATCH;
+
+typedef struct dh_check_executor_batch_item_st {
+    DH_CHECK_EXECUTOR_BATCH *batch;
+    DH_CHECK_JOB *job;
+} DH_CHECK_EXECUTOR_BATCH_ITEM;
+
+/* Worker side of ossl_dh_check_executor_run_batch(): run one job, count it */
+static void dh_check_executor_batch_run(void *arg)
+{
+    DH_CHECK_EXECUTOR_BATCH_ITEM *item = arg;
+
+    dh_check_job_run(item->job);
+    pthread_mutex_lock(&item->batch->executor->lock);
+    item->batch->remaining--;
+    pthread_mutex_unlock(&item->batch->executor->lock);
+}
+
+/**
+@brief Run several validation jobs on a dedicated executor and wait for all of them
+
+@param[in] executor Executor from ossl_dh_check_executor_new() (not NULL)
+@param[in,out] jobs Array of jobs prepared by ossl_dh_check_job_init()
+@param[in] njobs Number of jobs
+
+@return 1 once every job has run (inspect each with ossl_dh_check_job_result())
+@retval 0 on allocation failure, or if njobs is too large to allocate for
+        (no job was run)
+
+@details
+All jobs are queued before the caller sleeps, so they spread over every
+worker. A job the executor refuses is run on the calling thread instead,
+so every job always has a result when this returns.
+
+@warning Must not be called from one of the executor's own workers
+
+@see ossl_dh_check_executor_run(), ossl_dh_check_reload()
+*/
+int ossl_dh_check_executor_run_batch(DH_CHECK_EXECUTOR *executor,
+                                     DH_CHECK_JOB *jobs, size_t njobs)
+{
+    DH_CHECK_EXECUTOR_BATCH batch;
+    DH_CHECK_EXECUTOR_BATCH_ITEM *items;
+    size_t i;
+
+    if (njobs == 0)
+        return 1;
+    if (njobs > SIZE_MAX / sizeof(*items)) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+    if ((items = OPENSSL_malloc(njobs * sizeof(*items))) == NULL)
+        return 0;
+    batch.executor = executor;
+    batch.remaining = njobs;
+    for (i = 0; i < njobs; i++) {
+        items[i].batch = &batch;
+        items[i].job = &jobs[i];
+        if (!ossl_dh_check_executor_submit(dh_check_executor_batch_run,
+                                           &items[i], executor))
+            dh_check_executor_batch_run(&items[i]);
+    }
+    pthread_mutex_lock(&executor->lock);
+    while (batch.remaining > 0)
+        pthread_cond_wait(&executor->finished, &executor->lock);
+    pthread_mutex_unlock(&executor->lock);
+    OPENSSL_free(items);
+    return 1;
+}
+
+/**
+@brief Read the queue-depth and wait-time statistics of an executor
+
+@param[in] executor Executor (not NULL)
+@param[out] stats Snapshot of the statistics (not NULL)
+*/
+void ossl_dh_check_executor_get_stats(DH_CHECK_EXECUTOR *executor,
+                                      DH_CHECK_EXECUTOR_STATS *stats)
+{
+    pthread_mutex_lock(&executor->lock);
+    *stats = executor->stats;
+    pthread_mutex_unlock(&executor->lock);
+}
+#endif /* DH_CHECK_EXECUTOR_PTHREADS */
+
+#ifndef FIPS_MODULE
+/* One group of a validated set: its fingerprint and DH_check() verdict */
+typedef struct dh_check_set_entry_st {
+    unsigned char fingerprint[DH_PARAMS_FINGERPRINT_LEN];
+    int have_fingerprint;
+    int ok;                     /* DH_check() return value */
+    int flags;                  /* DH_check() error flags */
+} DH_CHECK_SET_ENTRY;
+
+struct dh_check_set_st {
+    DH_CHECK_SET_ENTRY *entries;    /* one per group, in the caller's order */
+    size_t nentries;
+    size_t ncarried;                /* verdicts taken from the previous set */
+    size_t nchecked;                /* groups run through DH_check() */
+};
+
+/*
+ * Find a reusable verdict for |fingerprint| in |set|. Only completed checks
+ * (ok == 1) are reused; an allocation failure last time is retried. A linear
+ * scan is plenty for configuration-sized sets.
+ */
+static const DH_CHECK_SET_ENTRY *dh_check_set_find(const DH_CHECK_SET *set,
+                                                   const unsigned char *fingerprint)
+{
+    size_t i;
+
+    for (i = 0; i < set->nentries; i++) {
+        if (set->entries[i].have_fingerprint
+            && set->entries[i].ok
+            && memcmp(set->entries[i].fingerprint, fingerprint,
+                      DH_PARAMS_FINGERPRINT_LEN) == 0)
+            return &set->entries[i];
+    }
+    return NULL;
+}
+
+/**
+@brief Free a validated set
+
+@param[in] set Set to free (NULL is a no-op)
+*/
+void ossl_dh_check_set_free(DH_CHECK_SET *set)
+{
+    if (set == NULL)
+        return;
+    OPENSSL_free(set->entries);
+    OPENSSL_free(set);
+}
+
+/**
+@brief Validate a reloaded list of DH groups, reusing verdicts for unchanged groups
+
+@param[in] prev Validated set from the previous load (NULL on first load)
+@param[in] groups New parameter sets, in configuration order
+@param[in] ngroups Number of groups
+@param[in] executor Executor to validate changed groups in parallel, or NULL
+           to validate them on the calling thread
+
+@return New validated set; entry i belongs to groups[i]
+@retval NULL on allocation failure, if ngroups is too large to allocate for,
+        or if an executor is passed on a platform without one
+
+@details
+Algorithm Flow (Plain English):
+1. Fingerprint every new group with ossl_dh_params_fingerprint()
+2. Look the fingerprint up in prev; on a hit, carry the verdict forward
+3. Queue a DH_CHECK_JOB_PARAMS job for every new or changed group
+4. Run the jobs, on the executor if one was given
+5. Store each verdict with its fingerprint for the next reload
+
+WHY THIS DESIGN:
+A configuration reload used to push every group through DH_check() again,
+although usually only one or two had changed. With fingerprints the cost of
+a reload is a SHA-256 per group plus DH_check() for the groups that really
+changed, and with an executor those run in parallel. The set does not keep
+pointers to the DH objects, so the previous configuration can be freed as
+soon as the reload returns.
+
+EDGE CASES:
+- Group that cannot be fingerprinted: always validated, never carried
+- Group whose previous check failed to complete (ok == 0): validated again
+- Same parameters listed twice in one load: each copy is checked; later
+  reloads carry both forward
+
+@warning The groups must not be modified while the reload runs
+
+@see ossl_dh_check_set_get(), ossl_dh_check_set_free(), ossl_dh_params_fingerprint()
+*/
+DH_CHECK_SET *ossl_dh_check_reload(const DH_CHECK_SET *prev,
+                                   DH *const *groups, size_t ngroups,
+                                   DH_CHECK_EXECUTOR *executor)
+{
+    DH_CHECK_SET *set;
+    DH_CHECK_SET_ENTRY *entry;
+    const DH_CHECK_SET_ENTRY *old;
+    DH_CHECK_JOB *jobs = NULL;
+    size_t *index = NULL;
+    size_t i, njobs = 0;
+
+#ifndef DH_CHECK_EXECUTOR_PTHREADS
+    if (executor != NULL) {
+        ERR_raise(ERR_LIB_DH, ERR_R_UNSUPPORTED);
+        return NULL;
+    }
+#endif
+    if ((set = OPENSSL_zalloc(sizeof(*set))) == NULL)
+        return NULL;
+    if (ngroups == 0)
+        return set;
+    if (ngroups > SIZE_MAX / sizeof(*set->entries)
+        || ngroups > SIZE_MAX / sizeof(*jobs)
+        || ngroups > SIZE_MAX / sizeof(*index)) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        goto err;
+    }
+    set->entries = OPENSSL_zalloc(ngroups * sizeof(*set->entries));
+    jobs = OPENSSL_malloc(ngroups * sizeof(*jobs));
+    index = OPENSSL_malloc(ngroups * sizeof(*index));
+    if (set->entries == NULL || jobs == NULL || index == NULL)
+        goto err;
+    set->nentries = ngroups;
+
+    for (i = 0; i < ngroups; i++) {
+        entry = &set->entries[i];
+        entry->have_fingerprint =
+            ossl_dh_params_fingerprint(groups[i], entry->fingerprint);
+        if (entry->have_fingerprint
+            && prev != NULL
+            && (old = dh_check_set_find(prev, entry->fingerprint)) != NULL) {
+            entry->ok = old->ok;
+            entry->flags = old->flags;
+            set->ncarried++;
+            continue;
+        }
+        ossl_dh_check_job_init(&jobs[njobs], DH_CHECK_JOB_PARAMS, groups[i],
+                               NULL, NULL, NULL);
+        index[njobs++] = i;
+    }
+
+#ifdef DH_CHECK_EXECUTOR_PTHREADS
+    if (executor != NULL) {
+        if (!ossl_dh_check_executor_run_batch(executor, jobs, njobs))
+            goto err;
+    } else
+#endif
+    {
+        for (i = 0; i < njobs; i++)
+            ossl_dh_check_job_submit(&jobs[i], NULL, NULL);
+    }
+    for (i = 0; i < njobs; i++) {
+        entry = &set->entries[index[i]];
+        entry->ok = ossl_dh_check_job_result(&jobs[i], &entry->flags);
+    }
+    set->nchecked = njobs;
+
+    OPENSSL_free(jobs);
+    OPENSSL_free(index);
+    return set;
+ err:
+    OPENSSL_free(jobs);
+    OPENSSL_free(index);
+    ossl_dh_check_set_free(set);
+    return NULL;
+}
+
+/**
+@brief Read the verdict for one group of a validated set
+
+@param[in] set Validated set from ossl_dh_check_reload() (not NULL)
+@param[in] i Index of the group in the groups array passed to the reload
+@param[out] ret DH_check() error flags for that group (not NULL)
+
+@return The DH_check() return value for that group
+@retval 0 also if i is out of range
+*/
+int ossl_dh_check_set_get(const DH_CHECK_SET *set, size_t i, int *ret)
+{
+    *ret = 0;
+    if (i >= set->nentries)
+        return 0;
+    *ret = set->entries[i].flags;
+    return set->entries[i].ok;
+}
+
+/**
+@brief Report how much work the reload that built a set did
+
+@param[in] set Validated set from ossl_dh_check_reload() (not NULL)
+@param[out] ncarried Verdicts carried forward unchanged (may be NULL)
+@param[out] nchecked Groups run through DH_check() (may be NULL)
+*/
+void ossl_dh_check_set_get_counts(const DH_CHECK_SET *set, size_t *ncarried,
+                                  size_t *nchecked)
+{
+    if (ncarried != NULL)
+        *ncarried = set->ncarried;
+    if (nchecked != NULL)
+        *nchecked = set->nchecked;
+}
+#endif /* FIPS_MODULE */
+
+#ifndef FIPS_MODULE
+/*
+ * Validation state of a promoted group for one NUMA node: copies of the
+ * parameters and the Montgomery context for p, all allocated by a thread on
+ * that node. Read-only once published. There are no fixed-base tables:
+ * g^x in the pair-wise check is an ordinary constant-time exponentiation
+ * with this Montgomery context.
+ */
+typedef struct dh_check_hot_replica_st {
+    BIGNUM *p, *q, *g;
+    BN_MONT_CTX *mont;
+} DH_CHECK_HOT_REPLICA;
+
+/*
+ * Promoted groups and their replicas are looked up without any lock where
+ * the compiler has the __atomic builtins, as in threads_pthread.c. Without
+ * them the same loads are done under the read lock.
+ */
+# if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE) \
+     && !defined(BROKEN_CLANG_ATOMICS)
+#  define DH_CHECK_HOT_ATOMICS
+#  define DH_CHECK_HOT_LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#  define DH_CHECK_HOT_STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# else
+#  define DH_CHECK_HOT_LOAD(p)        (*(p))
+#  define DH_CHECK_HOT_STORE(p, v)    (*(p) = (v))
+# endif
+
+/*
+ * One tracked custom group. The fingerprint of an entry changes only under
+ * the write lock and only while it is not promoted; promoted is set once,
+ * with a release store, and never cleared, so a reader that sees it set
+ * may compare the fingerprint without a lock. replica[] slots go from NULL
+ * to a replica once. uses is counted under the read lock with
+ * CRYPTO_atomic_add().
+ */
+typedef struct dh_check_hot_entry_st {
+    unsigned char fingerprint[DH_PARAMS_FINGERPRINT_LEN];
+    int uses;
+    int promoted;
+    DH_CHECK_HOT_REPLICA *replica[DH_CHECK_HOT_MAX_NODES];
+} DH_CHECK_HOT_ENTRY;
+
+struct dh_check_hot_st {
+    CRYPTO_RWLOCK *lock;            /* guards the slots of cold groups */
+    CRYPTO_RWLOCK *count_lock;      /* for CRYPTO_atomic_add() without atomics */
+    int threshold;
+    DH_CHECK_HOT_ENTRY *entries;    /* fixed array, so entries never move */
+    size_t nentries;
+    size_t max_entries;
+    size_t npromoted;               /* under the lock */
+    int nreplicas;                  /* CRYPTO_atomic_add() */
+};
+
+static void dh_check_hot_replica_free(DH_CHECK_HOT_REPLICA *replica)
+{
+    if (replica == NULL)
+        return;
+    BN_free(replica->p);
+    BN_free(replica->q);
+    BN_free(replica->g);
+    BN_MONT_CTX_free(replica->mont);
+    OPENSSL_free(replica);
+}
+
+/*
+ * Build a replica of the parameters of |dh| on the calling thread.
+ * Placement is best effort: Linux puts a fresh page on the node of the
+ * thread that first touches it, but OPENSSL_zalloc() and BN_dup() may hand
+ * back heap memory whose pages a thread on another node touched first
+ * (glibc reuses freed chunks across arenas), and nothing here binds the
+ * memory with mbind(). Doing that would need a NUMA-aware allocator under
+ * the BIGNUMs and the Montgomery context, which BN does not offer.
+ */
+static DH_CHECK_HOT_REPLICA *dh_check_hot_replica_new(const DH *dh)
+{
+    DH_CHECK_HOT_REPLICA *replica = OPENSSL_zalloc(sizeof(*replica));
+    BN_CTX *ctx = NULL;
+
+    if (replica == NULL)
+        return NULL;
+    if ((replica->p = BN_dup(dh->params.p)) == NULL
+        || (replica->g = BN_dup(dh->params.g)) == NULL
+        || (dh->params.q != NULL
+            && (replica->q = BN_dup(dh->params.q)) == NULL)
+        || (replica->mont = BN_MONT_CTX_new()) == NULL
+        || (ctx = BN_CTX_new_ex(dh->libctx)) == NULL
+        || !BN_MONT_CTX_set(replica->mont, replica->p, ctx)) {
+        BN_CTX_free(ctx);
+        dh_check_hot_replica_free(replica);
+        return NULL;
+    }
+    BN_CTX_free(ctx);
+    return replica;
+}
+
+/*
+ * NUMA node of the CPU the calling thread runs on, folded into the table.
+ * Without SYS_getcpu (anything but Linux) every thread reports node 0, so
+ * the tracker keeps a single replica per group.
+ */
+static unsigned int dh_check_hot_node(void)
+{
+#ifdef SYS_getcpu
+    unsigned int cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+        return node % DH_CHECK_HOT_MAX_NODES;
+#endif
+    return 0;
+}
+
+/**
+@brief Free a hot group tracker and the precomputed state of its promoted groups
+
+@param[in] hot Tracker to free (NULL is a no-op)
+
+@warning No ossl_dh_check_*_hot() call may still be running on it
+*/
+void ossl_dh_check_hot_free(DH_CHECK_HOT *hot)
+{
+    size_t i, n;
+
+    if (hot == NULL)
+        return;
+    for (i = 0; i < hot->nentries; i++)
+        for (n = 0; n < DH_CHECK_HOT_MAX_NODES; n++)
+            dh_check_hot_replica_free(hot->entries[i].replica[n]);
+    OPENSSL_free(hot->entries);
+    CRYPTO_THREAD_lock_free(hot->lock);
+    CRYPTO_THREAD_lock_free(hot->count_lock);
+    OPENSSL_free(hot);
+}
+
+/**
+@brief Create a tracker that promotes frequently used custom DH groups
+
+@param[in] threshold Uses after which a group is promoted (0 selects
+           DH_CHECK_HOT_DEFAULT_THRESHOLD)
+@param[in] max_groups Custom groups tracked at once (0 selects
+           DH_CHECK_HOT_DEFAULT_MAX_GROUPS)
+
+@return New tracker with no groups
+@retval NULL on allocation failure, or if max_groups is too large to
+        allocate for
+
+@note A promoted group gets one replica per NUMA node the calling threads
+      run on (ossl_dh_check_hot_num_replicas()); on systems without
+      getcpu() it gets exactly one. Keeping a replica in its node's memory
+      is best effort, see dh_check_hot_replica_new().
+
+@see ossl_dh_check_pub_key_hot_ctx(), ossl_dh_check_pairwise_hot_ctx()
+*/
+DH_CHECK_HOT *ossl_dh_check_hot_new(unsigned int threshold, size_t max_groups)
+{
+    DH_CHECK_HOT *hot;
+
+    if ((hot = OPENSSL_zalloc(sizeof(*hot))) == NULL)
+        return NULL;
+    if (threshold == 0)
+        threshold = DH_CHECK_HOT_DEFAULT_THRESHOLD;
+    hot->threshold = threshold > INT_MAX ? INT_MAX : (int)threshold;
+    hot->max_entries = max_groups != 0 ? max_groups
+                                       : DH_CHECK_HOT_DEFAULT_MAX_GROUPS;
+    if (hot->max_entries > SIZE_MAX / sizeof(*hot->entries)) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        ossl_dh_check_hot_free(hot);
+        return NULL;
+    }
+    hot->entries = OPENSSL_zalloc(hot->max_entries * sizeof(*hot->entries));
+    hot->lock = CRYPTO_THREAD_lock_new();
+    hot->count_lock = CRYPTO_THREAD_lock_new();
+    if (hot->entries == NULL
+        || hot->lock == NULL
+        || hot->count_lock == NULL) {
+        ossl_dh_check_hot_free(hot);
+        return NULL;
+    }
+    return hot;
+}
+
+/* Tracked entry for |fingerprint|, or NULL. Called with either lock held. */
+static DH_CHECK_HOT_ENTRY *dh_check_hot_find(DH_CHECK_HOT *hot,
+                                             const unsigned char *fingerprint)
+{
+    size_t i;
+
+    for (i = 0; i < hot->nentries; i++)
+        if (memcmp(hot->entries[i].fingerprint, fingerprint,
+                   DH_PARAMS_FINGERPRINT_LEN) == 0)
+            return &hot->entries[i];
+    return NULL;
+}
+
+/*
+ * Claim a tracking slot for |fingerprint|, taking a free one or replacing
+ * the least used group that is not promoted. Called with the write lock
+ * held; NULL when every slot holds a promoted group.
+ */
+static DH_CHECK_HOT_ENTRY *dh_check_hot_slot(DH_CHECK_HOT *hot,
+                                             const unsigned char *fingerprint)
+{
+    DH_CHECK_HOT_ENTRY *entry, *victim = NULL;
+    size_t i;
+
+    for (i = 0; i < hot->nentries; i++) {
+        entry = &hot->entries[i];
+        if (!entry->promoted
+            && (victim == NULL || entry->uses < victim->uses))
+            victim = entry;
+    }
+    if (hot->nentries < hot->max_entries) {
+        victim = &hot->entries[hot->nentries];
+        DH_CHECK_HOT_STORE(&hot->nentries, hot->nentries + 1);
+    }
+    if (victim != NULL) {
+        memcpy(victim->fingerprint, fingerprint, DH_PARAMS_FINGERPRINT_LEN);
+        victim->uses = 0;
+    }
+    return victim;
+}
+
+/*
+ * Promoted entry for |fingerprint|, or NULL. Lock-free with
+ * DH_CHECK_HOT_ATOMICS: only promoted entries are compared, and those
+ * never change their fingerprint.
+ */
+static DH_CHECK_HOT_ENTRY *dh_check_hot_find_promoted(DH_CHECK_HOT *hot,
+                                                      const unsigned char *fingerprint)
+{
+    DH_CHECK_HOT_ENTRY *entry = NULL;
+    size_t i, n;
+
+# ifndef DH_CHECK_HOT_ATOMICS
+    if (!CRYPTO_THREAD_read_lock(hot->lock))
+        return NULL;
+# endif
+    n = DH_CHECK_HOT_LOAD(&hot->nentries);
+    for (i = 0; i < n; i++) {
+        if (DH_CHECK_HOT_LOAD(&hot->entries[i].promoted)
+            && memcmp(hot->entries[i].fingerprint, fingerprint,
+                      DH_PARAMS_FINGERPRINT_LEN) == 0) {
+            entry = &hot->entries[i];
+            break;
+        }
+    }
+# ifndef DH_CHECK_HOT_ATOMICS
+    CRYPTO_THREAD_unlock(hot->lock);
+# endif
+    return entry;
+}
+
+/*
+ * Count one use of a group that was not found promoted, promoting it when
+ * the use reaches the threshold. Returns the entry if it is promoted now.
+ */
+static DH_CHECK_HOT_ENTRY *dh_check_hot_count(DH_CHECK_HOT *hot,
+                                              const unsigned char *fingerprint)
+{
+    DH_CHECK_HOT_ENTRY *entry;
+    int uses, found, promoted = 0, promote = 0;
+
+    if (!CRYPTO_THREAD_read_lock(hot->lock))
+        return NULL;
+    entry = dh_check_hot_find(hot, fingerprint);
+    found = entry != NULL;
+    if (found) {
+        promoted = entry->promoted;
+        if (!promoted
+            && CRYPTO_atomic_add(&entry->uses, 1, &uses, hot->count_lock))
+            promote = uses >= hot->threshold;
+    }
+    CRYPTO_THREAD_unlock(hot->lock);
+    if (promoted)
+        return entry;
+    if (found && !promote)
+        return NULL;
+
+    if (!CRYPTO_THREAD_write_lock(hot->lock))
+        return NULL;
+    if ((entry = dh_check_hot_find(hot, fingerprint)) == NULL
+        && (entry = dh_check_hot_slot(hot, fingerprint)) != NULL)
+        entry->uses++;
+    if (entry != NULL && !entry->promoted && entry->uses >= hot->threshold) {
+        DH_CHECK_HOT_STORE(&entry->promoted, 1);
+        hot->npromoted++;
+    }
+    if (entry != NULL && !entry->promoted)
+        entry = NULL;
+    CRYPTO_THREAD_unlock(hot->lock);
+    return entry;
+}
+
+/* Published replica of a promoted entry for |node|, or NULL */
+static DH_CHECK_HOT_REPLICA *dh_check_hot_replica_get(DH_CHECK_HOT *hot,
+                                                      DH_CHECK_HOT_ENTRY *entry,
+                                                      unsigned int node)
+{
+    DH_CHECK_HOT_REPLICA *replica;
+
+# ifdef DH_CHECK_HOT_ATOMICS
+    replica = DH_CHECK_HOT_LOAD(&entry->replica[node]);
+# else
+    if (!CRYPTO_THREAD_read_lock(hot->lock))
+        return NULL;
+    replica = entry->replica[node];
+    CRYPTO_THREAD_unlock(hot->lock);
+# endif
+    return replica;
+}
+
+/*
+ * Publish |replica| for |node| unless another caller got there first.
+ * Returns the published replica; ours is freed if it lost or on error.
+ */
+static DH_CHECK_HOT_REPLICA *dh_check_hot_replica_publish(DH_CHECK_HOT *hot,
+                                                          DH_CHECK_HOT_ENTRY *entry,
+                                                          unsigned int node,
+                                                          DH_CHECK_HOT_REPLICA *replica)
+{
+    DH_CHECK_HOT_REPLICA *published = NULL;
+    int n;
+
+# ifdef DH_CHECK_HOT_ATOMICS
+    if (__atomic_compare_exchange_n(&entry->replica[node], &published,
+                                    replica, 0, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE))
+        published = replica;
+# else
+    if (!CRYPTO_THREAD_write_lock(hot->lock)) {
+        dh_check_hot_replica_free(replica);
+        return NULL;
+    }
+    if ((published = entry->replica[node]) == NULL)
+        entry->replica[node] = published = replica;
+    CRYPTO_THREAD_unlock(hot->lock);
+# endif
+    if (published == replica)
+        CRYPTO_atomic_add(&hot->nreplicas, 1, &n, hot->count_lock);
+    else
+        dh_check_hot_replica_free(replica);
+    return published;
+}
+
+/**
+@brief Count one use of a group and return the local replica of its state if it is hot
+
+@param[in,out] hot Tracker (not NULL)
+@param[in] dh Group being used (not NULL)
+
+@return Replica for the calling thread's NUMA node, shared - callers must
+        only read it
+@retval NULL while the group is cold (or named, or cannot be tracked)
+
+@details
+Algorithm Flow (Plain English):
+1. Named groups are skipped - they have their own bypass
+2. Fingerprint p, g, q and j (on the stack, nothing allocated); p wider
+   than OPENSSL_DH_MAX_MODULUS_BITS is not tracked
+3. Look the fingerprint up among the promoted groups, without a lock
+4. Not promoted: count the use under the read lock with CRYPTO_atomic_add();
+   only an untracked group or the use that reaches the threshold takes the
+   write lock, to claim a slot or promote
+5. Promoted: load the replica for the caller's node (getcpu()) with an
+   acquire load and return it
+6. No replica on this node yet: build one outside any lock and publish it
+   with a compare-and-swap; if another caller on the node won, use theirs
+   and free ours
+
+WHY THIS DESIGN:
+DH_FLAG_CACHE_MONT_P caches the Montgomery context on one DH object, so it
+is lost whenever a handshake gets a fresh DH for the same custom group.
+Keying on the parameter fingerprint shares it across objects. One shared
+copy would still live on one memory node, and threads on the other socket
+would pay remote latency on every multiplication of p, q and the Montgomery
+constants; a replica per node removes that. A replica costs less than one
+exponentiation to build, so the first caller on each node does it inline.
+Once a group is hot its checks write nothing shared - no lock word, no use
+count - so the cache lines they read stay in every node's caches instead of
+bouncing between sockets, which would undo the point of node-local replicas.
+
+EDGE CASES:
+- No getcpu() (non-Linux): everything uses node 0, i.e. one shared copy
+- Replica memory not on the caller's node (reused heap chunks): still
+  correct, only locality is lost; see dh_check_hot_replica_new()
+- More nodes than DH_CHECK_HOT_MAX_NODES: nodes share slots modulo the limit
+- Thread migrates during a check: still correct, only locality is lost
+- Two callers on one node build a replica at once: one is published, the
+  other freed; a failed build or lock leaves nothing behind, so the next
+  call simply tries again
+- No __atomic builtins: steps 3, 5 and 6 take the read or write lock
+*/
+static const DH_CHECK_HOT_REPLICA *dh_check_hot_use(DH_CHECK_HOT *hot,
+                                                    const DH *dh)
+{
+    unsigned char fingerprint[DH_PARAMS_FINGERPRINT_LEN];
+    DH_CHECK_HOT_ENTRY *entry;
+    DH_CHECK_HOT_REPLICA *replica;
+    unsigned int node;
+
+    if (DH_get_nid(dh) != NID_undef
+        || dh->params.p == NULL
+        || dh->params.g == NULL
+        || BN_num_bits(dh->params.p) > OPENSSL_DH_MAX_MODULUS_BITS
+        || !ossl_dh_params_fingerprint(dh, fingerprint))
+        return NULL;
+    if ((entry = dh_check_hot_find_promoted(hot, fingerprint)) == NULL
+        && (entry = dh_check_hot_count(hot, fingerprint)) == NULL)
+        return NULL;
+
+    node = dh_check_hot_node();
+    if ((replica = dh_check_hot_replica_get(hot, entry, node)) != NULL)
+        return replica;
+    if ((replica = dh_check_hot_replica_new(dh)) == NULL)
+        return NULL;
+    return dh_check_hot_replica_publish(hot, entry, node, replica);
+}
+
+/**
+@brief DH_check_pub_key() that uses precomputed state once the group is hot
+
+@param[in,out] hot Tracker from ossl_dh_check_hot_new() (not NULL)
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] pub_key Public key to validate (not NULL)
+@param[in] ctx BN_CTX for the subgroup check (NULL to allocate one when needed)
+@param[out] ret Pointer to int for validation error flags (initialized by callee)
+
+@return Same as DH_check_pub_key()
+
+@details
+A cold group goes straight to DH_check_pub_key(), with nothing allocated
+here. A hot one gets the range check on stack bytes followed by
+pub_key^q mod p on the replica of the caller's NUMA node, so the flags are
+identical either way. Only that exponentiation needs a BN_CTX, so a caller
+that validates many keys passes its own and the hot path allocates nothing
+once the replica exists.
+
+@see ossl_dh_check_pub_key_hot(), DH_check_pub_key()
+*/
+int ossl_dh_check_pub_key_hot_ctx(DH_CHECK_HOT *hot, const DH *dh,
+                                  const BIGNUM *pub_key, BN_CTX *ctx,
+                                  int *ret)
+{
+    const DH_CHECK_HOT_REPLICA *replica;
+    BN_CTX *new_ctx = NULL;
+    BIGNUM *tmp;
+    int ok = 0;
+
+    if ((replica = dh_check_hot_use(hot, dh)) == NULL)
+        return DH_check_pub_key(dh, pub_key, ret);
+    if (!dh_check_pub_key_range(dh, pub_key, ret))
+        return 0;
+    if (replica->q == NULL)
+        return 1;
+
+    if (ctx == NULL
+        && (ctx = new_ctx = BN_CTX_new_ex(dh->libctx)) == NULL)
+        return 0;
+    BN_CTX_start(ctx);
+    tmp = BN_CTX_get(ctx);
+    if (tmp == NULL
+        || !BN_mod_exp_mont(tmp, pub_key, replica->q, replica->p,
+                            ctx, replica->mont))
+        goto err;
+    if (!BN_is_one(tmp))
+        *ret |= FFC_ERROR_PUBKEY_INVALID;
+    ok = *ret == 0;
+ err:
+    BN_CTX_end(ctx);
+    BN_CTX_free(new_ctx);
+    return ok;
+}
 
-@note Use ossl_dh_check_pub_key_partial() for ephemeral keys (faster)
-@note Full validation is expensive - cache result if validating same key multiple times
+/**
+@brief ossl_dh_check_pub_key_hot_ctx() with a BN_CTX allocated when needed
 
-@see ossl_dh_check_pub_key_partial(), ossl_ffc_validate_public_key()
+@param[in,out] hot Tracker from ossl_dh_check_hot_new() (not NULL)
+@param[in] dh DH parameter structure (must be initialized, not NULL)
+@param[in] pub_key Public key to validate (not NULL)
+@param[out] ret Pointer to int for validation error flags (initialized by callee)
+
+@return Same as DH_check_pub_key()
 */
-int DH_check_pub_key(const DH *dh, const BIGNUM *pub_key, int *ret)
+int ossl_dh_check_pub_key_hot(DH_CHECK_HOT *hot, const DH *dh,
+                              const BIGNUM *pub_key, int *ret)
 {
-    return ossl_ffc_validate_public_key(&dh->params, pub_key, ret);
+    return ossl_dh_check_pub_key_hot_ctx(hot, dh, pub_key, NULL, ret);
 }
 
-/*
- * See SP800-56Ar3 Section 5.6.2.3.1 : FFC Partial public key validation.
- * To only be used with ephemeral FFC public keys generated using the approved
- * safe-prime groups.
- */
-
 /**
-@brief Partial public key validation for ephemeral keys (faster, safe-prime groups only)
+@brief ossl_dh_check_pairwise() that uses precomputed state once the group is hot
 
-@param[in] dh DH parameter structure with safe-prime group parameters (must be initialized, not NULL)
-@param[in] pub_key Ephemeral public key value to validate (must not be NULL)
-@param[out] ret Pointer to int for validation error flags (initialized by callee)
+@param[in,out] hot Tracker from ossl_dh_check_hot_new() (not NULL)
+@param[in] dh DH structure with both public and private keys set
+@param[in] ctx BN_CTX to use (NULL to allocate one)
 
-@return 1 on success (public key valid for ephemeral use)
-@retval 0 on failure (validation error - check *ret for specific failure)
+@return Same as ossl_dh_check_pairwise()
 
 @details
-Algorithm Flow (Plain English):
-Delegates to ossl_ffc_validate_public_key_partial() which implements:
-1. Verify pub_key is in valid range: 2 <= pub_key <= p-2
-2. Skip expensive subgroup membership test (g^q == 1 mod p)
-3. Rely on safe-prime group properties for security
+On a hot group g^priv mod p is recomputed with BN_mod_exp_mont_consttime()
+on the replica of the caller's NUMA node. Keys whose DH_METHOD is not the
+built-in one always take ossl_dh_check_pairwise_ctx(), so an ENGINE still
+sees the exponentiation; so does a cold group, which allocates nothing here
+beyond what ossl_dh_check_pairwise_ctx() itself needs.
 
-WHY THIS DESIGN:
-SP800-56Ar3 Section 5.6.2.3.1 allows "partial" validation for ephemeral public keys
-when using approved safe-prime groups (RFC 7919 groups ffdhe2048, ffdhe3072, etc.).
+@see ossl_dh_check_pub_key_hot_ctx(), ossl_dh_check_pairwise_ctx()
+*/
+int ossl_dh_check_pairwise_hot_ctx(DH_CHECK_HOT *hot, const DH *dh,
+                                   BN_CTX *ctx)
+{
+    const DH_CHECK_HOT_REPLICA *replica;
+    BN_CTX *new_ctx = NULL;
+    BIGNUM *pub_key;
+    int ok = 0;
 
-Safe-prime groups have mathematical properties that make the expensive subgroup
-membership test (pub_key^q == 1 mod p) unnecessary:
-- All non-identity elements generate the full group
-- No small subgroups exist
-- Simple range check is sufficient
+    if (dh->params.p == NULL
+        || dh->params.g == NULL
+        || dh->priv_key == NULL
+        || dh->pub_key == NULL)
+        return 0;
+    replica = dh->meth == DH_OpenSSL() ? dh_check_hot_use(hot, dh) : NULL;
+    if (replica == NULL)
+        return ossl_dh_check_pairwise_ctx(dh, ctx);
 
-PERFORMANCE BENEFIT:
-Full validation: O(n³) for subgroup test
-Partial validation: O(1) range check only
-Speedup: 100-1000x faster for ephemeral key validation
+    if (ctx == NULL
+        && (ctx = new_ctx = BN_CTX_new_ex(dh->libctx)) == NULL)
+        return 0;
+    BN_CTX_start(ctx);
+    pub_key = BN_CTX_get(ctx);
+    if (pub_key != NULL
+        && BN_mod_exp_mont_consttime(pub_key, replica->g, dh->priv_key,
+                                     replica->p, ctx, replica->mont))
+        ok = BN_cmp(pub_key, dh->pub_key) == 0;
+    BN_CTX_end(ctx);
+    BN_CTX_free(new_ctx);
+    return ok;
+}
 
-WHEN TO USE:
-- Ephemeral (single-use) DH keys in TLS, SSH, IKE
-- Parameters from approved safe-prime groups (RFC 7919)
-- Performance-critical key exchange
+/**
+@brief ossl_dh_check_pairwise_hot_ctx() with a BN_CTX allocated when needed
 
-WHEN NOT TO USE:
-- Static (long-term) public keys → use DH_check_pub_key()
-- Custom (non-approved) parameter groups → use DH_check_pub_key()
-- FIPS compliance with explicit validation requirements → use DH_check_pub_key()
+@param[in,out] hot Tracker from ossl_dh_check_hot_new() (not NULL)
+@param[in] dh DH structure with both public and private keys set
 
-SECURITY GUARANTEE:
-For approved safe-prime groups, partial validation provides equivalent security
-to full validation but with dramatically better performance.
+@return Same as ossl_dh_check_pairwise()
+*/
+int ossl_dh_check_pairwise_hot(DH_CHECK_HOT *hot, const DH *dh)
+{
+    return ossl_dh_check_pairwise_hot_ctx(hot, dh, NULL);
+}
 
-EDGE CASES:
-- pub_key <= 1: Invalid (trivial)
-- pub_key >= p-1: Invalid (trivial)
-- Non-safe-prime group: Results undefined (caller must ensure safe-prime group)
+/**
+@brief Number of custom groups a tracker has promoted so far
 
-@warning Only use with approved safe-prime groups (RFC 7919)
-@warning Do NOT use for static/long-term public keys
+@param[in] hot Tracker (not NULL)
+*/
+size_t ossl_dh_check_hot_num_promoted(DH_CHECK_HOT *hot)
+{
+    size_t n = 0;
 
-@see DH_check_pub_key(), ossl_ffc_validate_public_key_partial()
+    if (CRYPTO_THREAD_read_lock(hot->lock)) {
+        n = hot->npromoted;
+        CRYPTO_THREAD_unlock(hot->lock);
+    }
+    return n;
+}
+
+/**
+@brief Number of per-node replicas a tracker has built for its promoted groups
+
+@param[in] hot Tracker (not NULL)
 */
-int ossl_dh_check_pub_key_partial(const DH *dh, const BIGNUM *pub_key, int *ret)
+size_t ossl_dh_check_hot_num_replicas(DH_CHECK_HOT *hot)
 {
-    return ossl_ffc_validate_public_key_partial(&dh->params, pub_key, ret);
+    int n = 0;
+
+    if (!CRYPTO_atomic_add(&hot->nreplicas, 0, &n, hot->count_lock))
+        return 0;
+    return (size_t)n;
 }
+#endif /* FIPS_MODULE */
 
+#ifndef FIPS_MODULE
 /**
-@brief Validate DH private key is in correct range
+@brief Read the aggregated profile of one validation phase and modulus size
 
-@param[in] dh DH parameter structure containing domain parameters (must be initialized, not NULL)
-@param[in] priv_key Private key value to validate (must not be NULL)
-@param[out] ret Pointer to int for validation error flags (initialized to 0 by this function)
+@param[in] phase One of the DH_CHECK_PROF_* phases
+@param[in] size Modulus size bucket, 0 .. DH_CHECK_PROF_NSIZES - 1 (p up to
+           1024, 2048, 3072, 4096, 6144, 8192 bits, or larger)
+@param[out] stats Calls, wall-clock time and summed counter deltas (not NULL)
 
-@return 1 on success (private key valid)
-@retval 0 on failure (allocation error or private key out of range)
+@return 1 on success
+@retval 0 if profiling is not compiled in or phase/size is out of range
 
 @details
 Algorithm Flow (Plain English):
-1. Initialize *ret = 0
-2. Allocate temporary BIGNUM two_powN
-3. Determine upper bound for private key validation:
-   a. If q exists: upper = q (standard case)
-   b. If q missing but p exists (non-FIPS only): use bit-length based validation
-   c. If q from approved group AND dh->length set: upper = min(2^length, q)
-4. Validate private key is in range [1, upper-1]
-5. Clean up and return
+1. Each thread opens one perf_event group on first use: cycles,
+   instructions, cache misses and branch misses, user space only
+2. Every profiled phase reads the group before and after and adds the
+   deltas and the elapsed time to a global [phase][size] table
+3. This function copies one cell of that table
 
 WHY THIS DESIGN:
-Private key validation has three different paths to handle different parameter scenarios:
-
-PATH 1 (Standard, q exists): 
-- Private key must be in [1, q-1]
-- This is the cryptographically correct range for modern DH
-
-PATH 2 (Legacy, no q, non-FIPS only):
-- No explicit subgroup order available
-- Fall back to bit-length validation
-- If dh->length set: private key must have exactly that many bits
-- If dh->length not set: private key must be in [2, p-2] with reasonable bit length
-
-PATH 3 (Approved group with length restriction):
-- Some approved groups specify shorter private key lengths for performance
-- Validate against min(2^dh->length, q) to enforce both security and spec
-
-VALIDATION GUARANTEES:
-Success means private key is:
-- Non-zero (not the identity)
-- Less than the group order (in proper range)
-- Has appropriate bit length (if length constraint exists)
+IPC (instructions / cycles) and miss rates of the exponentiation and
+primality kernels are what decide whether an optimisation helps, and an
+external profiler cannot attribute them to a DH_check() phase or a modulus
+size. The counters run for the thread's lifetime, so a phase costs two
+read() calls and the rest of the build is untouched: without
+OPENSSL_DH_CHECK_PROFILE the hooks compile to nothing.
 
 EDGE CASES:
-- priv_key == 0: Invalid (identity element, no security)
-- priv_key >= q: Invalid (out of subgroup range)
-- priv_key >= p (when q missing): Invalid (out of total range)
-- Allocation failure for two_powN: Returns 0
-- No q and no p: Returns 0 (cannot validate)
+- No PMU, perf_event_paranoid too strict or seccomp: calls and ns are still
+  recorded, samples[] stays 0 for the missing counters
+- A counter missing on some threads only: divide count[i] by samples[i],
+  not by calls
+- Named groups return before any phase in DH_check(), so they only show up
+  in PUB_KEY and PAIRWISE
 
-NON-FIPS SPECIAL CASE:
-Lines 261-285 handle legacy parameters without q parameter.
-This is a compatibility feature - modern code should always use parameters with q.
-The bit-length based validation provides basic sanity checking but is not
-cryptographically rigorous.
+@note Counters include everything the thread does during the phase,
+      including time spent in a BN_GENCB callback
 
-APPROVED GROUP OPTIMIZATION:
-When using approved safe-prime groups with specified private key length,
-we validate against 2^length rather than full q. This allows shorter
-private keys (e.g., 256 bits instead of 2048 bits) for performance while
-maintaining security.
+@see ossl_dh_check_prof_print(), ossl_dh_check_prof_reset()
+*/
+int ossl_dh_check_prof_get(int phase, int size, DH_CHECK_PROF_STATS *stats)
+{
+#ifdef DH_CHECK_PROFILE
+    if (phase < 0 || phase >= DH_CHECK_PROF_NPHASES
+        || size < 0 || size >= DH_CHECK_PROF_NSIZES)
+        return 0;
+    pthread_mutex_lock(&dh_prof_lock);
+    *stats = dh_prof_stats[phase][size];
+    pthread_mutex_unlock(&dh_prof_lock);
+    return 1;
+#else
+    memset(stats, 0, sizeof(*stats));
+    return 0;
+#endif
+}
 
-@warning Non-FIPS path allows validation without q (legacy compatibility)
-@warning Validation without q uses heuristic bit-length checks, not rigorous math
+/**
+@brief Clear the aggregated profile
 
-@see ossl_ffc_validate_private_key(), DH_generate_key()
+@details
+Counter groups stay open; only the table read by ossl_dh_check_prof_get()
+is cleared.
 */
-int ossl_dh_check_priv_key(const DH *dh, const BIGNUM *priv_key, int *ret)
+void ossl_dh_check_prof_reset(void)
 {
-    int ok = 0;
-    BIGNUM *two_powN = NULL, *upper;
+#ifdef DH_CHECK_PROFILE
+    pthread_mutex_lock(&dh_prof_lock);
+    memset(dh_prof_stats, 0, sizeof(dh_prof_stats));
+    pthread_mutex_unlock(&dh_prof_lock);
+#endif
+}
 
-    *ret = 0;
-    two_powN = BN_new();
-    if (two_powN == NULL)
-        return 0;
+/**
+@brief Print the aggregated profile as a table
 
-    if (dh->params.q != NULL) {
-        upper = dh->params.q;
-#ifndef FIPS_MODULE
-    } else if (dh->params.p != NULL) {
-        /*
-         * We do not have q so we just check the key is within some
-         * reasonable range, or the number of bits is equal to dh->length.
-         */
-        int length = dh->length;
+@param[in] out BIO to print to (not NULL)
 
-        if (length == 0) {
-            /* No length specified - validate bit count is reasonable */
-            length = BN_num_bits(dh->params.p) - 1;
-            if (BN_num_bits(priv_key) <= length
-                && BN_num_bits(priv_key) > 1)
-                ok = 1;
-        } else if (BN_num_bits(priv_key) == length) {
-            /* Length specified - validate exact bit count */
-            ok = 1;
+@return 1 on success
+@retval 0 if profiling is not compiled in
+
+@details
+One row per phase and size with calls, microseconds per call, IPC, and
+cache and branch misses per call. A counter that was never available
+prints as "-".
+*/
+int ossl_dh_check_prof_print(BIO *out)
+{
+#ifdef DH_CHECK_PROFILE
+    static const char *const phase_names[DH_CHECK_PROF_NPHASES] = {
+        "params", "generator", "q_prime", "q_divides_p",
+        "p_prime", "p_safe_prime", "pub_key", "pairwise"
+    };
+    DH_CHECK_PROF_STATS st;
+    int phase, size;
+
+    BIO_printf(out, "%-13s %6s %10s %12s %6s %13s %13s\n", "phase", "bits",
+               "calls", "us/call", "IPC", "cache-miss/c", "branch-miss/c");
+    for (phase = 0; phase < DH_CHECK_PROF_NPHASES; phase++) {
+        for (size = 0; size < DH_CHECK_PROF_NSIZES; size++) {
+            if (!ossl_dh_check_prof_get(phase, size, &st) || st.calls == 0)
+                continue;
+            BIO_printf(out, "%-13s %5s%d %10llu %12.1f", phase_names[phase],
+                       size < DH_CHECK_PROF_NSIZES - 1 ? "<=" : ">",
+                       dh_prof_bucket_bits[size < DH_CHECK_PROF_NSIZES - 1
+                                           ? size : size - 1],
+                       (unsigned long long)st.calls,
+                       (double)st.ns / st.calls / 1000);
+            if (st.samples[DH_CHECK_PROF_CYCLES] != 0
+                && st.samples[DH_CHECK_PROF_INSTRUCTIONS] != 0
+                && st.count[DH_CHECK_PROF_CYCLES] != 0)
+                BIO_printf(out, " %6.2f",
+                           (double)st.count[DH_CHECK_PROF_INSTRUCTIONS]
+                           / st.count[DH_CHECK_PROF_CYCLES]);
+            else
+                BIO_printf(out, " %6s", "-");
+            if (st.samples[DH_CHECK_PROF_CACHE_MISSES] != 0)
+                BIO_printf(out, " %13.1f",
+                           (double)st.count[DH_CHECK_PROF_CACHE_MISSES]
+                           / st.samples[DH_CHECK_PROF_CACHE_MISSES]);
+            else
+                BIO_printf(out, " %13s", "-");
+            if (st.samples[DH_CHECK_PROF_BRANCH_MISSES] != 0)
+                BIO_printf(out, " %13.1f\n",
+                           (double)st.count[DH_CHECK_PROF_BRANCH_MISSES]
+                           / st.samples[DH_CHECK_PROF_BRANCH_MISSES]);
+            else
+                BIO_printf(out, " %13s\n", "-");
         }
-        goto end;
-#endif
-    } else {
-        /* No q and no p (or FIPS mode without q) - cannot validate */
-        goto end;
     }
+    return 1;
+#else
+    return 0;
+#endif
+}
+#endif /* FIPS_MODULE */
 
-    /* Is it from an approved Safe prime group ?*/
-    if (DH_get_nid((DH *)dh) != NID_undef && dh->length != 0) {
-        /* Approved group with length restriction */
-        if (!BN_lshift(two_powN, BN_value_one(), dh->length))
-            goto end;
-        if (BN_cmp(two_powN, dh->params.q) < 0)
-            upper = two_powN;
-    }
-    /* Validate private key is in [1, upper-1] */
-    if (!ossl_ffc_validate_private_key(upper, priv_key, ret))
-        goto end;
+#ifndef FIPS_MODULE
+/*
+ * Feed |bn| to |mctx| as a 4-byte big-endian length and the big-endian value.
+ * BN_bn2bin() drops the sign, so a negative |bn| is refused rather than MAC'd
+ * like its absolute value.
+ */
+static int dh_provenance_mac_bn(EVP_MAC_CTX *mctx, const BIGNUM *bn,
+                                unsigned char *buf, size_t bufsize)
+{
+    size_t len = (size_t)BN_num_bytes(bn);
+    int ok;
 
-    ok = 1;
-end:
-    BN_free(two_powN);
+    if (BN_is_negative(bn) || len > bufsize - 4)
+        return 0;
+    buf[0] = (unsigned char)(len >> 24);
+    buf[1] = (unsigned char)(len >> 16);
+    buf[2] = (unsigned char)(len >> 8);
+    buf[3] = (unsigned char)len;
+    BN_bn2bin(bn, buf + 4);
+    ok = EVP_MAC_update(mctx, buf, 4 + len);
+    OPENSSL_cleanse(buf, 4 + len);
     return ok;
 }
 
 /*
- * FFC pairwise check from SP800-56A R3.
- *    Section 5.6.2.1.4 Owner Assurance of Pair-wise Consistency
+ * HMAC-SHA256 under |key| over a domain label, the version, the parameter
+ * fingerprint, pub_key, priv_key and the verdict byte.
  */
+static int dh_provenance_mac(const DH *dh, const unsigned char *key,
+                             size_t keylen, unsigned char verdict,
+                             unsigned char *md)
+{
+    static const char label[] = "OpenSSL DH pairwise provenance";
+    unsigned char head[2 + DH_PARAMS_FINGERPRINT_LEN];
+    unsigned char buf[4 + (OPENSSL_DH_MAX_MODULUS_BITS + 7) / 8];
+    OSSL_PARAM params[2];
+    EVP_MAC *mac = NULL;
+    EVP_MAC_CTX *mctx = NULL;
+    size_t mdlen;
+    int ok = 0;
+
+    head[0] = DH_PROVENANCE_VERSION;
+    head[1] = verdict;
+    if (!ossl_dh_params_fingerprint(dh, head + 2))
+        return 0;
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                                 (char *)"SHA2-256", 0);
+    params[1] = OSSL_PARAM_construct_end();
+
+    mac = EVP_MAC_fetch(dh->libctx, "HMAC", NULL);
+    if (mac == NULL
+        || (mctx = EVP_MAC_CTX_new(mac)) == NULL
+        || !EVP_MAC_init(mctx, key, keylen, params)
+        || !EVP_MAC_update(mctx, (const unsigned char *)label, sizeof(label))
+        || !EVP_MAC_update(mctx, head, sizeof(head))
+        || !dh_provenance_mac_bn(mctx, dh->pub_key, buf, sizeof(buf))
+        || !dh_provenance_mac_bn(mctx, dh->priv_key, buf, sizeof(buf))
+        || !EVP_MAC_final(mctx, md, &mdlen, SHA256_DIGEST_LENGTH))
+        goto err;
+    ok = mdlen == SHA256_DIGEST_LENGTH;
+ err:
+    EVP_MAC_CTX_free(mctx);
+    EVP_MAC_free(mac);
+    return ok;
+}
 
 /**
-@brief Verify DH public/private key pair consistency
+@brief Run the pair-wise test once and record its verdict in a MAC'd provenance record
 
 @param[in] dh DH structure with both public and private keys set (all fields must be non-NULL)
+@param[in] key Local MAC key, e.g. held by the keystore (not NULL)
+@param[in] keylen Length of key, at least DH_PROVENANCE_MIN_KEY_LEN
+@param[out] rec DH_PROVENANCE_LEN bytes to store next to the serialized key
+@param[in] reclen Size of rec
 
-@return 1 on success (key pair is consistent)
-@retval 0 on failure (keys are inconsistent, allocation error, or missing parameters)
+@return 1 if the key pair passed ossl_dh_check_pairwise() and rec was written
+@retval 0 if it failed the test, or on a bad argument or MAC failure (rec is
+        cleared)
 
 @details
 Algorithm Flow (Plain English):
-1. Verify all required parameters exist (p, g, priv_key, pub_key)
-2. Allocate BN_CTX and temporary BIGNUM for recalculated public key
-3. Recalculate public key from private key: pub_calc = g^priv_key mod p
-4. Compare recalculated public key with stored public key
-5. Return 1 if they match (keys are consistent), 0 otherwise
-6. Clean up allocated resources
+1. Run ossl_dh_check_pairwise() - only a passing pair gets a record
+2. HMAC-SHA256 under key over a label, the record version, the verdict,
+   ossl_dh_params_fingerprint() and the length-prefixed pub_key and priv_key
+3. rec = version || verdict || MAC
 
 WHY THIS DESIGN:
-SP800-56A R3 Section 5.6.2.1.4 requires "Owner Assurance of Pair-wise Consistency"
-to verify that a public/private key pair is mathematically consistent before use.
+Keys from our own keygen are re-checked every time they are loaded from a
+keystore, each time repeating g^priv mod p. A record bound to the exact
+parameters and key pair lets ossl_dh_check_pairwise_provenance() replace
+that with one HMAC. The MAC covers priv_key as well, so a record cannot be
+moved to another key pair with the same public key, and the label keeps it
+apart from any other HMAC made under the same key.
+
+@warning The MAC key must be as well protected as the keystore: whoever holds
+         it can vouch for arbitrary key pairs
+@note The private key bytes are cleansed from the stack after hashing
+
+@see ossl_dh_check_pairwise_provenance(), ossl_dh_check_pairwise()
+*/
+int ossl_dh_pairwise_provenance_create(const DH *dh, const unsigned char *key,
+                                       size_t keylen, unsigned char *rec,
+                                       size_t reclen)
+{
+    if (reclen < DH_PROVENANCE_LEN || keylen < DH_PROVENANCE_MIN_KEY_LEN) {
+        ERR_raise(ERR_LIB_DH, ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+    rec[0] = DH_PROVENANCE_VERSION;
+    rec[1] = 1;
+    if (!ossl_dh_check_pairwise(dh)
+        || !dh_provenance_mac(dh, key, keylen, rec[1], rec + 2)) {
+        OPENSSL_cleanse(rec, DH_PROVENANCE_LEN);
+        return 0;
+    }
+    return 1;
+}
 
-This prevents:
-- Using corrupted key material (memory corruption, disk errors)
-- Using mismatched public/private keys (configuration errors)
-- Using keys generated with faulty random number generators
-- Certain implementation attacks where keys are manipulated
+/**
+@brief ossl_dh_check_pairwise() that trusts a valid provenance record instead of recomputing
 
-The check is simple: if pub_key was correctly generated from priv_key using the
-DH formula (g^priv mod p), then recalculating it should yield the same result.
+@param[in] dh DH structure with both public and private keys set (all fields must be non-NULL)
+@param[in] key Local MAC key the record was created under (not NULL)
+@param[in] keylen Length of key
+@param[in] rec Provenance record loaded with the key, or NULL if it had none
+@param[in] reclen Length of rec
 
-WHEN TO USE:
-- After loading keys from storage (detect corruption)
-- After key generation (detect RNG failures)
-- Before using keys for sensitive operations (paranoid validation)
-- FIPS compliance may require this check
+@return 1 if the key pair is consistent (by record or by recomputation)
+@retval 0 if it is not, or on failure
 
-PERFORMANCE:
-Modular exponentiation (g^priv mod p) is moderately expensive:
-- O(n²) to O(n³) depending on exponent size
-- For 2048-bit DH: 1-10ms on modern hardware
-- Much faster than primality testing, but not trivial
+@details
+Algorithm Flow (Plain English):
+1. No record, wrong length, unknown version or verdict: full test
+2. Recompute the MAC for the loaded parameters and key pair
+3. CRYPTO_memcmp() against the stored MAC: equal means the pair is the one
+   that passed at creation, return 1 without the exponentiation
+4. Otherwise (tampered record, other key pair, other MAC key): full test
 
 EDGE CASES:
-- Missing p, g, priv_key, or pub_key: Returns 0 immediately
-- Allocation failure (ctx or pub_key): Returns 0
-- Recalculation failure in ossl_dh_generate_public_key(): Returns 0
-- Keys match: Returns 1
-- Keys don't match: Returns 0
-
-SECURITY NOTE:
-This does NOT validate that keys are cryptographically strong, only that they
-are mathematically consistent with each other. You still need DH_check(),
-DH_check_pub_key(), and ossl_dh_check_priv_key() for full security validation.
-
-@warning Does NOT validate cryptographic strength, only mathematical consistency
-@warning All parameters (p, g, priv_key, pub_key) must be non-NULL
+- Key rotated: old records stop matching and the full test runs, so a
+  rotation never rejects a good key pair
+- MAC unavailable (e.g. no HMAC in the loaded providers): full test
+- A negative parameter or key component has no MAC, so the full test runs
+  and a record for y never vouches for -y
 
-@see ossl_dh_generate_public_key(), SP800-56A R3 Section 5.6.2.1.4
+@see ossl_dh_pairwise_provenance_create(), ossl_dh_check_pairwise()
 */
-int ossl_dh_check_pairwise(const DH *dh)
+int ossl_dh_check_pairwise_provenance(const DH *dh, const unsigned char *key,
+                                      size_t keylen, const unsigned char *rec,
+                                      size_t reclen)
 {
-    int ret = 0;
-    BN_CTX *ctx = NULL;
-    BIGNUM *pub_key = NULL;
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    int match;
 
     if (dh->params.p == NULL
         || dh->params.g == NULL
         || dh->priv_key == NULL
         || dh->pub_key == NULL)
         return 0;
-
-    ctx = BN_CTX_new_ex(dh->libctx);
-    if (ctx == NULL)
-        goto err;
-    pub_key = BN_new();
-    if (pub_key == NULL)
-        goto err;
-
-    /* recalculate the public key = (g ^ priv) mod p */
-    if (!ossl_dh_generate_public_key(ctx, dh, dh->priv_key, pub_key))
-        goto err;
-    /* check it matches the existing pubic_key */
-    ret = BN_cmp(pub_key, dh->pub_key) == 0;
-err:
-    BN_free(pub_key);
-    BN_CTX_free(ctx);
-    return ret;
-}
\ No newline at end of file
+    if (rec == NULL
+        || reclen != DH_PROVENANCE_LEN
+        || rec[0] != DH_PROVENANCE_VERSION
+        || rec[1] != 1
+        || keylen < DH_PROVENANCE_MIN_KEY_LEN
+        || !dh_provenance_mac(dh, key, keylen, rec[1], md))
+        return ossl_dh_check_pairwise(dh);
+    match = CRYPTO_memcmp(md, rec + 2, sizeof(md)) == 0;
+    OPENSSL_cleanse(md, sizeof(md));
+    return match ? 1 : ossl_dh_check_pairwise(dh);
+}
+#endif /* FIPS_MODULE */
@@ -0,0 +1,663 @@
+/*
+ * Copyright 2021 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/**
+@file dh_check_bench.c
+@brief In-memory FFDHE handshake simulator measuring the share of DH validation cost
+
+@details
+Runs complete finite-field Diffie-Hellman key agreements between two
+in-process peers, with no sockets, and times every step. Each step goes
+through the EVP layer, which maps onto dh_check.c functions as follows:
+
+  step                    EVP call                     dh_check.c function
+  ----------------------  ---------------------------  ------------------------------
+  params (full)           EVP_PKEY_param_check()       DH_check()
+  keygen                  EVP_PKEY_generate()          (dh_key.c)
+  priv_key                EVP_PKEY_private_check()     ossl_dh_check_priv_key()
+  keypair                 EVP_PKEY_pairwise_check()    DH_check_pub_key() (full),
+                                                       ossl_dh_check_priv_key() and
+                                                       ossl_dh_check_pairwise()
+  pub_key (partial)       EVP_PKEY_public_check_quick() ossl_dh_check_pub_key_partial()
+  pub_key (full)          EVP_PKEY_public_check()      DH_check_pub_key()
+  derive                  EVP_PKEY_derive()            (dh_key.c)
+
+Algorithm Flow (Plain English), per handshake:
+1. The client validates the group it was offered (params)
+2. Each peer generates a key pair and checks its private key and the
+   pair-wise consistency of the pair (SP800-56Ar3 5.6.2.1.4)
+3. Each peer validates the other's public key: partial for named safe-prime
+   groups, full for custom groups (the ossl_dh_check_pub_key_policy() rule)
+4. Each peer derives the shared secret and the two secrets are compared
+
+A group is run for a fixed wall-clock time and the report gives handshakes
+per second plus the share of the total time spent in each step, which is
+where an optimisation of dh_check.c pays off end to end.
+
+EVP_PKEY_pairwise_check() is the only EVP entry to the pair-wise test, and
+it validates the whole key pair first. The report therefore derives the
+cost of ossl_dh_check_pairwise() alone by taking the per-call cost of the
+private key step and of the full public key step off the keypair step.
+The full public key step only runs for custom groups or with -F, so named
+groups need -F for that line.
+
+With -m the handshakes are replaced by micro-benchmarks that call dh_check.c
+entry points directly on the group's parameters and one generated key:
+
+  line                    compares
+  ----------------------  ----------------------------------------------------
+  pub_key hot             DH_check_pub_key() against
+                          ossl_dh_check_pub_key_hot_ctx() once the group is
+                          promoted (custom groups; named ones are not tracked)
+  partial_batch           ossl_dh_check_pub_key_partial() per key against
+                          ossl_dh_check_pub_key_partial_batch() in keys per
+                          second
+  strategy                ossl_dh_check_strategy() with the EXPLICIT and the
+                          FIPS186_4 strategy on the seeded parameters (custom
+                          groups), the data a cost rule between them needs
+
+-m needs the internal build described below, as those functions are not
+exported from libcrypto.
+
+Usage:
+  dh_check_bench [-t seconds] [-F] [-m] [group ...]
+
+  group     ffdhe2048 ... ffdhe8192, modp_2048 ... modp_8192, or
+            custom:BITS for freshly generated FIPS 186-4 (DHX) parameters
+            (BITS is 2048 or 3072, the sizes FIPS 186-4 allows)
+            (default: ffdhe2048 ffdhe3072 custom:2048)
+  -t        seconds per group (default 3; at least one handshake always runs)
+  -F        use full public key validation for named groups as well
+  -m        run the micro-benchmarks instead of handshakes
+
+Build (against an installed OpenSSL 3.x):
+  cc -O2 -o dh_check_bench dh_check_bench.c -lcrypto
+
+Build with -m (from the top of a configured and built source tree):
+  cc -O2 -DDH_CHECK_BENCH_INTERNAL -Iinclude -Icrypto/dh -I. \
+     -o dh_check_bench dh_check_bench.c libcrypto.a -lpthread
+
+@note Full DH_check() on a custom group runs primality tests on p and q, so
+      expect custom groups to complete only a handful of handshakes per
+      second - that is the cost this benchmark is meant to expose
+@see dh_check.c
+*/
+
+#ifdef DH_CHECK_BENCH_INTERNAL
+/* The micro-benchmarks build DH objects with the low level API */
+# include "internal/deprecated.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/evp.h>
+#include <openssl/err.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#ifdef DH_CHECK_BENCH_INTERNAL
+# include <openssl/bn.h>
+# include <openssl/dh.h>
+# include "crypto/dh.h"
+# include "dh_check_local.h"
+#endif
+
+/* Steps of one handshake, in the order they are reported */
+enum {
+    STEP_PARAMS,
+    STEP_KEYGEN,
+    STEP_PRIV_KEY,
+    STEP_KEYPAIR,
+    STEP_PUB_PARTIAL,
+    STEP_PUB_FULL,
+    STEP_DERIVE,
+    STEP_COUNT
+};
+
+static const char *const step_names[STEP_COUNT] = {
+    "DH_check (params)",
+    "keygen",
+    "ossl_dh_check_priv_key",
+    "keypair (pub+priv+pairwise)",
+    "ossl_dh_check_pub_key_partial",
+    "DH_check_pub_key (full)",
+    "derive"
+};
+
+/* Accumulated time per step for one group */
+typedef struct bench_times_st {
+    double ns[STEP_COUNT];
+    unsigned long calls[STEP_COUNT];
+} BENCH_TIMES;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Charge the time since *start to |step| and restart the clock */
+static void lap(BENCH_TIMES *t, int step, double *start)
+{
+    double end = now_ns();
+
+    t->ns[step] += end - *start;
+    t->calls[step]++;
+    *start = end;
+}
+
+/**
+@brief Create the key generation context for a named or custom group
+
+@param[in] group Group name, or "custom:BITS"
+
+@return Context ready for EVP_PKEY_generate()
+@retval NULL on failure (unknown group, parameter generation failure)
+
+@details
+Named groups are selected by name; custom groups get FIPS 186-4 (DHX)
+parameters generated once here, outside the timed region.
+*/
+static EVP_PKEY_CTX *keygen_ctx_new(const char *group)
+{
+    EVP_PKEY_CTX *pctx = NULL, *kctx = NULL;
+    EVP_PKEY *params = NULL;
+    OSSL_PARAM gen[3];
+    size_t bits;
+
+    if (strncmp(group, "custom:", 7) != 0) {
+        kctx = EVP_PKEY_CTX_new_from_name(NULL, "DH", NULL);
+        if (kctx == NULL
+            || EVP_PKEY_keygen_init(kctx) <= 0
+            || EVP_PKEY_CTX_set_group_name(kctx, group) <= 0)
+            goto err;
+        return kctx;
+    }
+
+    bits = (size_t)atoi(group + 7);
+    gen[0] = OSSL_PARAM_construct_utf8_string(OSSL_PKEY_PARAM_FFC_TYPE,
+                                              (char *)"fips186_4", 0);
+    gen[1] = OSSL_PARAM_construct_size_t(OSSL_PKEY_PARAM_FFC_PBITS, &bits);
+    gen[2] = OSSL_PARAM_construct_end();
+    /* FIPS 186-4 generation is only offered for X9.42 (DHX) keys */
+    pctx = EVP_PKEY_CTX_new_from_name(NULL, "DHX", NULL);
+    if (bits < 512
+        || pctx == NULL
+        || EVP_PKEY_paramgen_init(pctx) <= 0
+        || EVP_PKEY_CTX_set_params(pctx, gen) <= 0
+        || EVP_PKEY_paramgen(pctx, &params) <= 0)
+        goto err;
+    kctx = EVP_PKEY_CTX_new_from_pkey(NULL, params, NULL);
+    if (kctx == NULL || EVP_PKEY_keygen_init(kctx) <= 0)
+        goto err;
+    EVP_PKEY_free(params);
+    EVP_PKEY_CTX_free(pctx);
+    return kctx;
+ err:
+    EVP_PKEY_CTX_free(kctx);
+    EVP_PKEY_free(params);
+    EVP_PKEY_CTX_free(pctx);
+    return NULL;
+}
+
+/* Run one validation call on |key|, charging it to |step| */
+static int check_step(BENCH_TIMES *t, int step, EVP_PKEY *key, double *start)
+{
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_pkey(NULL, key, NULL);
+    int ok = 0;
+
+    if (ctx != NULL) {
+        switch (step) {
+        case STEP_PARAMS:
+            ok = EVP_PKEY_param_check(ctx) > 0;
+            break;
+        case STEP_PRIV_KEY:
+            ok = EVP_PKEY_private_check(ctx) > 0;
+            break;
+        case STEP_KEYPAIR:
+            ok = EVP_PKEY_pairwise_check(ctx) > 0;
+            break;
+        case STEP_PUB_PARTIAL:
+            ok = EVP_PKEY_public_check_quick(ctx) > 0;
+            break;
+        case STEP_PUB_FULL:
+            ok = EVP_PKEY_public_check(ctx) > 0;
+            break;
+        }
+    }
+    EVP_PKEY_CTX_free(ctx);
+    lap(t, step, start);
+    return ok;
+}
+
+/* Derive the shared secret of |own| with |peer| into |secret| */
+static int derive(EVP_PKEY *own, EVP_PKEY *peer, unsigned char *secret,
+                  size_t *secretlen)
+{
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_pkey(NULL, own, NULL);
+    int ok;
+
+    /* The peer key was validated in its own step; do not count it twice */
+    ok = ctx != NULL
+         && EVP_PKEY_derive_init(ctx) > 0
+         && EVP_PKEY_derive_set_peer_ex(ctx, peer, 0) > 0
+         && EVP_PKEY_derive(ctx, secret, secretlen) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+
+/**
+@brief Simulate one FFDHE handshake between two in-process peers
+
+@param[in] kctx Key generation context for the group
+@param[in] full_pub Use full rather than partial public key validation
+@param[in,out] t Per-step time accumulator
+
+@return 1 if every step succeeded and both peers derived the same secret
+@retval 0 otherwise
+*/
+static int handshake(EVP_PKEY_CTX *kctx, int full_pub, BENCH_TIMES *t)
+{
+    EVP_PKEY *client = NULL, *server = NULL;
+    unsigned char s1[1024], s2[1024];
+    size_t s1len = sizeof(s1), s2len = sizeof(s2);
+    int pub_step = full_pub ? STEP_PUB_FULL : STEP_PUB_PARTIAL;
+    int ok = 0;
+    double start = now_ns();
+
+    if (EVP_PKEY_generate(kctx, &server) <= 0)
+        goto err;
+    lap(t, STEP_KEYGEN, &start);
+    /* The client validates the group the server offered */
+    if (!check_step(t, STEP_PARAMS, server, &start))
+        goto err;
+    if (EVP_PKEY_generate(kctx, &client) <= 0)
+        goto err;
+    lap(t, STEP_KEYGEN, &start);
+
+    if (!check_step(t, STEP_PRIV_KEY, server, &start)
+        || !check_step(t, STEP_KEYPAIR, server, &start)
+        || !check_step(t, STEP_PRIV_KEY, client, &start)
+        || !check_step(t, STEP_KEYPAIR, client, &start)
+        || !check_step(t, pub_step, client, &start)
+        || !check_step(t, pub_step, server, &start))
+        goto err;
+
+    if (!derive(server, client, s1, &s1len))
+        goto err;
+    lap(t, STEP_DERIVE, &start);
+    if (!derive(client, server, s2, &s2len))
+        goto err;
+    lap(t, STEP_DERIVE, &start);
+
+    ok = s1len == s2len && memcmp(s1, s2, s1len) == 0;
+ err:
+    OPENSSL_cleanse(s1, sizeof(s1));
+    OPENSSL_cleanse(s2, sizeof(s2));
+    EVP_PKEY_free(client);
+    EVP_PKEY_free(server);
+    return ok;
+}
+
+/* Average time of one call of |step|, in ns */
+static double per_call_ns(const BENCH_TIMES *t, int step)
+{
+    return t->calls[step] == 0 ? 0 : t->ns[step] / t->calls[step];
+}
+
+/* Print handshakes per second and the time share of every step */
+static void report(const char *group, unsigned long n, double elapsed_ns,
+                   const BENCH_TIMES *t)
+{
+    double total = 0, validation = 0;
+    int i;
+
+    for (i = 0; i < STEP_COUNT; i++)
+        total += t->ns[i];
+    printf("\n%s: %lu handshakes in %.2f s = %.1f handshakes/s\n",
+           group, n, elapsed_ns / 1e9, n * 1e9 / elapsed_ns);
+    printf("  %-32s %8s %12s %7s\n", "step", "calls", "us/call", "share");
+    for (i = 0; i < STEP_COUNT; i++) {
+        if (t->calls[i] == 0)
+            continue;
+        printf("  %-32s %8lu %12.1f %6.1f%%\n", step_names[i], t->calls[i],
+               t->ns[i] / t->calls[i] / 1e3, 100.0 * t->ns[i] / total);
+        if (i != STEP_KEYGEN && i != STEP_DERIVE)
+            validation += t->ns[i];
+    }
+    /* The keypair step includes the full public and the private key check */
+    if (t->calls[STEP_KEYPAIR] > 0 && t->calls[STEP_PRIV_KEY] > 0) {
+        if (t->calls[STEP_PUB_FULL] > 0)
+            printf("  %-32s %8s %12.1f\n", "ossl_dh_check_pairwise (derived)",
+                   "", (per_call_ns(t, STEP_KEYPAIR)
+                        - per_call_ns(t, STEP_PRIV_KEY)
+                        - per_call_ns(t, STEP_PUB_FULL)) / 1e3);
+        else
+            printf("  %-32s %8s %12s\n", "ossl_dh_check_pairwise (derived)",
+                   "", "(needs -F)");
+    }
+    printf("  %-32s %8s %12s %6.1f%%\n", "all dh_check.c validation", "", "",
+           100.0 * validation / total);
+}
+
+#ifdef DH_CHECK_BENCH_INTERNAL
+/* Nanoseconds per call and calls made by one micro-benchmark line */
+typedef struct micro_result_st {
+    double ns;
+    unsigned long calls;
+} MICRO_RESULT;
+
+/* One call of the function being timed; returns 0 on failure */
+typedef int (*MICRO_FN)(void *arg);
+
+/* Call |fn| until |seconds| have passed (at least once) */
+static int micro_time(MICRO_FN fn, void *arg, double seconds,
+                      MICRO_RESULT *res)
+{
+    double start = now_ns(), elapsed;
+
+    res->calls = 0;
+    do {
+        if (!fn(arg))
+            return 0;
+        res->calls++;
+        elapsed = now_ns() - start;
+    } while (elapsed < seconds * 1e9);
+    res->ns = elapsed / res->calls;
+    return 1;
+}
+
+/* One report line; the rate counts |per_call| items (keys) per call */
+static void micro_print(const char *name, const MICRO_RESULT *res,
+                        size_t per_call)
+{
+    printf("  %-32s %8lu %12.2f %12.0f/s\n", name, res->calls,
+           res->ns / 1e3, 1e9 * per_call / res->ns);
+}
+
+/*
+ * Copy the parameters and key pair of |key| into a DH built with the low
+ * level API, so the micro-benchmarks call dh_check.c on it directly
+ */
+static DH *micro_dh_new(const EVP_PKEY *key)
+{
+    static const char *const names[] = {
+        OSSL_PKEY_PARAM_FFC_P, OSSL_PKEY_PARAM_FFC_Q, OSSL_PKEY_PARAM_FFC_G,
+        OSSL_PKEY_PARAM_PUB_KEY, OSSL_PKEY_PARAM_PRIV_KEY
+    };
+    BIGNUM *bn[5] = { NULL, NULL, NULL, NULL, NULL };
+    DH *dh = DH_new();
+    size_t i;
+
+    for (i = 0; i < 5; i++)
+        /* q is optional */
+        if (!EVP_PKEY_get_bn_param(key, names[i], &bn[i]) && i != 1)
+            goto err;
+    if (dh == NULL || !DH_set0_pqg(dh, bn[0], bn[1], bn[2]))
+        goto err;
+    bn[0] = bn[1] = bn[2] = NULL;
+    if (!DH_set0_key(dh, bn[3], bn[4]))
+        goto err;
+    return dh;
+ err:
+    for (i = 0; i < 5; i++)
+        BN_clear_free(bn[i]);
+    DH_free(dh);
+    return NULL;
+}
+
+typedef struct micro_pub_key_st {
+    DH_CHECK_HOT *hot;
+    const DH *dh;
+    const BIGNUM *pub_key;
+    BN_CTX *ctx;
+} MICRO_PUB_KEY;
+
+static int micro_pub_key_cold(void *arg)
+{
+    MICRO_PUB_KEY *m = arg;
+    int ret;
+
+    return DH_check_pub_key(m->dh, m->pub_key, &ret) && ret == 0;
+}
+
+static int micro_pub_key_hot(void *arg)
+{
+    MICRO_PUB_KEY *m = arg;
+    int ret;
+
+    return ossl_dh_check_pub_key_hot_ctx(m->hot, m->dh, m->pub_key, m->ctx,
+                                         &ret)
+           && ret == 0;
+}
+
+/* Keys in one ossl_dh_check_pub_key_partial_batch() call */
+# define MICRO_BATCH_KEYS 256
+
+typedef struct micro_batch_st {
+    const DH *dh;
+    const BIGNUM *pub_key;
+    unsigned char *keys;
+    size_t keylen;
+    unsigned char flags[MICRO_BATCH_KEYS];
+} MICRO_BATCH;
+
+static int micro_partial(void *arg)
+{
+    MICRO_BATCH *m = arg;
+    int ret;
+
+    return ossl_dh_check_pub_key_partial(m->dh, m->pub_key, &ret) && ret == 0;
+}
+
+static int micro_partial_batch(void *arg)
+{
+    MICRO_BATCH *m = arg;
+
+    return ossl_dh_check_pub_key_partial_batch(m->dh, m->keys, m->keylen,
+                                               MICRO_BATCH_KEYS, m->flags)
+           && m->flags[MICRO_BATCH_KEYS - 1] == 0;
+}
+
+typedef struct micro_strategy_st {
+    const DH *dh;
+    int strategy;
+} MICRO_STRATEGY;
+
+static int micro_strategy(void *arg)
+{
+    MICRO_STRATEGY *m = arg;
+    int ret;
+
+    return ossl_dh_check_strategy(m->dh, m->strategy, &ret) && ret == 0;
+}
+
+/**
+@brief Run the micro-benchmarks for one group
+
+@param[in] group Group name, for the report
+@param[in] kctx Key generation context for the group
+@param[in] seconds Time per line
+
+@return 1 on success
+@retval 0 if a key cannot be generated or a timed call fails
+
+@details
+The hot tracker is created with a threshold of 1, so the first call
+promotes the group and the timed calls all take the hot path.
+
+The partial lines report keys per second: one key per
+ossl_dh_check_pub_key_partial() call, MICRO_BATCH_KEYS copies of the
+generated public key per ossl_dh_check_pub_key_partial_batch() call.
+
+The strategy lines validate the group with both ossl_dh_check_strategy()
+strategies. They need the FIPS 186-4 seed, which EVP_PKEY_get1_DH() keeps
+and the low level copy from micro_dh_new() does not, and are skipped for
+named groups, where both strategies return at the named group check.
+*/
+static int micro(const char *group, EVP_PKEY_CTX *kctx, double seconds)
+{
+    EVP_PKEY *key = NULL;
+    DH *dh = NULL, *seeded = NULL;
+    MICRO_PUB_KEY pk = { NULL, NULL, NULL, NULL };
+    MICRO_BATCH mb;
+    MICRO_STRATEGY ms = { NULL, DH_CHECK_STRATEGY_EXPLICIT };
+    MICRO_RESULT cold, hot, single, batch, expl, regen;
+    size_t i;
+    int ok = 0;
+
+    memset(&mb, 0, sizeof(mb));
+
+    if (EVP_PKEY_generate(kctx, &key) <= 0
+        || (dh = micro_dh_new(key)) == NULL
+        || (seeded = EVP_PKEY_get1_DH(key)) == NULL
+        || (pk.hot = ossl_dh_check_hot_new(1, 0)) == NULL
+        || (pk.ctx = BN_CTX_new()) == NULL)
+        goto err;
+    pk.dh = dh;
+    pk.pub_key = DH_get0_pub_key(dh);
+    mb.dh = dh;
+    mb.pub_key = pk.pub_key;
+    mb.keylen = (size_t)BN_num_bytes(DH_get0_p(dh));
+    if ((mb.keys = OPENSSL_malloc(mb.keylen * MICRO_BATCH_KEYS)) == NULL)
+        goto err;
+    for (i = 0; i < MICRO_BATCH_KEYS; i++)
+        if (BN_bn2binpad(mb.pub_key, mb.keys + i * mb.keylen,
+                         (int)mb.keylen) < 0)
+            goto err;
+
+    printf("\n%s:\n", group);
+    printf("  %-32s %8s %12s %14s\n", "line", "calls", "us/call", "rate");
+    if (!micro_time(micro_pub_key_cold, &pk, seconds, &cold)
+        || !micro_pub_key_hot(&pk)
+        || !micro_time(micro_pub_key_hot, &pk, seconds, &hot))
+        goto err;
+    micro_print("DH_check_pub_key (cold)", &cold, 1);
+    if (ossl_dh_check_hot_num_promoted(pk.hot) == 0) {
+        printf("  %-32s %8s %12s\n", "pub_key hot", "",
+               "(not tracked)");
+    } else {
+        micro_print("ossl_dh_check_pub_key_hot_ctx", &hot, 1);
+        printf("  %-32s %8s %11.2fx\n", "pub_key hot speedup", "",
+               cold.ns / hot.ns);
+    }
+
+    if (!micro_time(micro_partial, &mb, seconds, &single)
+        || !micro_time(micro_partial_batch, &mb, seconds, &batch))
+        goto err;
+    micro_print("partial (keys)", &single, 1);
+    micro_print("partial_batch (keys)", &batch, MICRO_BATCH_KEYS);
+    printf("  %-32s %8s %11.2fx\n", "partial_batch speedup", "",
+           single.ns * MICRO_BATCH_KEYS / batch.ns);
+
+    if (DH_get_nid(seeded) != NID_undef) {
+        printf("  %-32s %8s %12s\n", "strategy", "", "(named group)");
+    } else {
+        ms.dh = seeded;
+        if (!micro_time(micro_strategy, &ms, seconds, &expl))
+            goto err;
+        ms.strategy = DH_CHECK_STRATEGY_FIPS186_4;
+        if (!micro_time(micro_strategy, &ms, seconds, &regen))
+            goto err;
+        micro_print("strategy EXPLICIT", &expl, 1);
+        micro_print("strategy FIPS186_4", &regen, 1);
+        printf("  %-32s %8s %11.2fx\n", "FIPS186_4 / EXPLICIT", "",
+               regen.ns / expl.ns);
+    }
+    ok = 1;
+ err:
+    OPENSSL_free(mb.keys);
+    ossl_dh_check_hot_free(pk.hot);
+    BN_CTX_free(pk.ctx);
+    DH_free(seeded);
+    DH_free(dh);
+    EVP_PKEY_free(key);
+    return ok;
+}
+#endif /* DH_CHECK_BENCH_INTERNAL */
+
+int main(int argc, char **argv)
+{
+    static const char *const default_groups[] = {
+        "ffdhe2048", "ffdhe3072", "custom:2048"
+    };
+    const char *const *groups = default_groups;
+    int ngroups = 3, full_named = 0, micro_mode = 0, ret = EXIT_SUCCESS, i;
+    double seconds = 3;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-F") == 0) {
+            full_named = 1;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            micro_mode = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-t seconds] [-F] [-m] [group ...]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+#ifndef DH_CHECK_BENCH_INTERNAL
+    if (micro_mode) {
+        fprintf(stderr, "%s: -m needs a DH_CHECK_BENCH_INTERNAL build\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+#endif
+    if (i < argc) {
+        groups = (const char *const *)argv + i;
+        ngroups = argc - i;
+    }
+
+    for (i = 0; i < ngroups; i++) {
+        BENCH_TIMES t;
+        EVP_PKEY_CTX *kctx = keygen_ctx_new(groups[i]);
+        int custom = strncmp(groups[i], "custom:", 7) == 0;
+        unsigned long n = 0;
+        double start, elapsed;
+
+        if (kctx == NULL) {
+            fprintf(stderr, "%s: cannot set up group\n", groups[i]);
+            ERR_print_errors_fp(stderr);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+#ifdef DH_CHECK_BENCH_INTERNAL
+        if (micro_mode) {
+            if (!micro(groups[i], kctx, seconds)) {
+                fprintf(stderr, "%s: micro-benchmark failed\n", groups[i]);
+                ERR_print_errors_fp(stderr);
+                ret = EXIT_FAILURE;
+            }
+            EVP_PKEY_CTX_free(kctx);
+            continue;
+        }
+#endif
+        memset(&t, 0, sizeof(t));
+        start = now_ns();
+        do {
+            if (!handshake(kctx, custom || full_named, &t)) {
+                fprintf(stderr, "%s: handshake %lu failed\n", groups[i], n);
+                ERR_print_errors_fp(stderr);
+                ret = EXIT_FAILURE;
+                break;
+            }
+            n++;
+            elapsed = now_ns() - start;
+        } while (elapsed < seconds * 1e9);
+        if (n > 0)
+            report(groups[i], n, elapsed, &t);
+        EVP_PKEY_CTX_free(kctx);
+    }
+    return ret;
+}
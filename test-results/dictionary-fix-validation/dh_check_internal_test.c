@@ -0,0 +1,1708 @@
+/*
+ * Copyright 2021 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * Internal tests for the dh_check.c entry points declared in
+ * dh_check_local.h. Link against the static libcrypto.
+ *
+ * This is a plain main() rather than a testutil test so that the allocator
+ * test_no_alloc() counts with can be installed before libcrypto makes its
+ * first allocation. Build it with the same OPENSSL_DH_CHECK_NO_ALLOC setting
+ * as dh_check.c to test that profile. Output is TAP.
+ *
+ * The other tests call entry points outside the profile, so this file opts
+ * out of the compile-time check in dh_check_local.h. Building it with
+ * -DOPENSSL_DH_CHECK_NO_ALLOC -DTEST_NO_ALLOC_MUST_FAIL must fail with
+ * "allocates: outside OPENSSL_DH_CHECK_NO_ALLOC" at every such call.
+ */
+
+/* We need to use some deprecated APIs */
+#include "internal/deprecated.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/async.h>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/dh.h>
+#include <openssl/err.h>
+#include <openssl/objects.h>
+#include "internal/nelem.h"
+#include "crypto/dh.h"
+#ifndef TEST_NO_ALLOC_MUST_FAIL
+# define DH_CHECK_ALLOW_ALLOC
+#endif
+#include "dh_check_local.h"
+#if defined(OPENSSL_THREADS) && defined(OPENSSL_SYS_UNIX)
+# include <pthread.h>
+# define TEST_STACK
+# define TEST_EXECUTOR
+#endif
+#ifdef __linux__
+# include <unistd.h>
+# include <sys/syscall.h>
+# if defined(SYS_getcpu) && defined(SYS_sched_getaffinity) \
+     && defined(SYS_sched_setaffinity)
+#  define TEST_PER_NODE
+#  define TEST_MAX_CPUS 1024
+#  define TEST_MASK_WORDS (TEST_MAX_CPUS / (8 * sizeof(unsigned long)))
+#  if defined(TEST_EXECUTOR) && defined(SYS_gettid)
+#   include <sys/resource.h>
+#   define TEST_PLACEMENT
+#  endif
+# endif
+#endif
+
+/* Heap allocations made through OPENSSL_malloc() while counting is set */
+static int counting;
+static size_t nallocs;
+
+static void *count_malloc(size_t num, const char *file, int line)
+{
+    if (counting)
+        nallocs++;
+    return malloc(num);
+}
+
+static void *count_realloc(void *addr, size_t num, const char *file, int line)
+{
+    if (counting)
+        nallocs++;
+    return realloc(addr, num);
+}
+
+static void count_free(void *addr, const char *file, int line)
+{
+    free(addr);
+}
+
+#define TEST_true(e)                                                        \
+    ((e) ? 1 : (fprintf(stderr, "# %s:%d: %s failed\n", __FILE__, __LINE__, \
+                        #e), 0))
+
+/* Oakley group 2 (RFC 2409) with the given generator and optional q */
+static DH *make_oakley1024(long g, int with_q)
+{
+    DH *dh = DH_new();
+    BIGNUM *p = BN_get_rfc2409_prime_1024(NULL);
+    BIGNUM *bg = BN_new(), *q = NULL;
+
+    if (dh == NULL || p == NULL || bg == NULL
+        || !BN_set_word(bg, (BN_ULONG)(g < 0 ? -g : g)))
+        goto err;
+    BN_set_negative(bg, g < 0);
+    if (with_q && ((q = BN_new()) == NULL || !BN_rshift1(q, p)))
+        goto err;
+    if (!DH_set0_pqg(dh, p, q, bg))
+        goto err;
+    return dh;
+ err:
+    BN_free(p);
+    BN_free(q);
+    BN_free(bg);
+    DH_free(dh);
+    return NULL;
+}
+
+/* g and -g must never share a fingerprint */
+static int test_fingerprint_sign(void)
+{
+    unsigned char md[DH_PARAMS_FINGERPRINT_LEN], neg[DH_PARAMS_FINGERPRINT_LEN];
+    DH *dh = make_oakley1024(2, 0), *dh_neg = make_oakley1024(-2, 0);
+    int ok = 0;
+
+    if (!TEST_true(dh != NULL && dh_neg != NULL)
+        || !TEST_true(ossl_dh_params_fingerprint(dh, md)))
+        goto err;
+    memset(neg, 0, sizeof(neg));
+    if (ossl_dh_params_fingerprint(dh_neg, neg)
+        && !TEST_true(memcmp(md, neg, sizeof(md)) != 0))
+        goto err;
+    ok = 1;
+ err:
+    DH_free(dh);
+    DH_free(dh_neg);
+    return ok;
+}
+
+/*
+ * The Oakley groups are in the compiled-in table to be refused for their
+ * size, whichever tests are selected. The table must only be used for the
+ * exact parameters: g = -2 with the Oakley 1024 prime is not a generator.
+ */
+static int test_known_group_sign(void)
+{
+    DH *dh = make_oakley1024(2, 1), *dh_neg = make_oakley1024(-2, 0);
+    BIGNUM *q = NULL;
+    int ok = 0, flags = -1;
+
+    if (!TEST_true(dh != NULL && dh_neg != NULL)
+        || !TEST_true(DH_check(dh, &flags))
+        || !TEST_true(flags == DH_MODULUS_TOO_SMALL)
+        || !TEST_true(ossl_dh_check_mask(dh, DH_CHECK_MASK_GENERATOR, &flags))
+        || !TEST_true(flags == DH_MODULUS_TOO_SMALL)
+        || !TEST_true(!DH_check_ex(dh)))
+        goto err;
+    ERR_clear_error();
+
+    flags = 0;
+    if (!TEST_true(DH_check(dh_neg, &flags))
+        || !TEST_true((flags & DH_NOT_SUITABLE_GENERATOR) != 0))
+        goto err;
+
+    /* The same with a negated q = (p - 1) / 2 */
+    if (!TEST_true((q = BN_dup(DH_get0_q(dh))) != NULL))
+        goto err;
+    BN_set_negative(q, 1);
+    if (!TEST_true(DH_set0_pqg(dh, NULL, q, NULL)))
+        goto err;
+    q = NULL;
+    flags = 0;
+    if (!TEST_true(DH_check(dh, &flags))
+        || !TEST_true(flags != 0))
+        goto err;
+    ok = 1;
+ err:
+    BN_free(q);
+    DH_free(dh);
+    DH_free(dh_neg);
+    return ok;
+}
+
+/* A provenance record made for pub_key must not vouch for -pub_key */
+static int test_provenance_sign(void)
+{
+    static const unsigned char key[DH_PROVENANCE_MIN_KEY_LEN] = { 1, 2, 3 };
+    unsigned char rec[DH_PROVENANCE_LEN];
+    DH *dh = make_oakley1024(2, 1);
+    BIGNUM *priv = BN_new(), *pub = BN_new();
+    BN_CTX *ctx = BN_CTX_new();
+    int ok = 0;
+
+    if (!TEST_true(dh != NULL && priv != NULL && pub != NULL && ctx != NULL)
+        || !TEST_true(BN_rand(priv, 160, BN_RAND_TOP_ONE, BN_RAND_BOTTOM_ANY))
+        || !TEST_true(BN_mod_exp(pub, DH_get0_g(dh), priv, DH_get0_p(dh),
+                                 ctx))
+        || !TEST_true(DH_set0_key(dh, pub, priv)))
+        goto err;
+    priv = pub = NULL;
+    if (!TEST_true(ossl_dh_pairwise_provenance_create(dh, key, sizeof(key),
+                                                      rec, sizeof(rec)))
+        || !TEST_true(ossl_dh_check_pairwise_provenance(dh, key, sizeof(key),
+                                                        rec, sizeof(rec))))
+        goto err;
+
+    BN_set_negative((BIGNUM *)DH_get0_pub_key(dh), 1);
+    if (!TEST_true(!ossl_dh_check_pairwise_provenance(dh, key, sizeof(key),
+                                                      rec, sizeof(rec))))
+        goto err;
+    ok = 1;
+ err:
+    BN_free(priv);
+    BN_free(pub);
+    BN_CTX_free(ctx);
+    DH_free(dh);
+    return ok;
+}
+
+/*
+ * A validated key handle is only honoured for the parameter values it was
+ * validated against and up to the level that was actually applied, and a
+ * group handle stops vouching for its DH once the values change. The custom
+ * group uses g = 4 so that it is not refused as a known Oakley group.
+ */
+static int test_validated_pub_key_binding(void)
+{
+    DH *named = DH_new_by_nid(NID_ffdhe2048), *custom = make_oakley1024(4, 1);
+    DH *same = make_oakley1024(4, 1), *raw;
+    DH_VALIDATED_GROUP *gn = NULL, *gc = NULL, *gs = NULL;
+    DH_VALIDATED_PUBKEY *kn = NULL, *kc = NULL;
+    BIGNUM *yn = BN_new(), *yc = BN_new(), *g = BN_new();
+    int ok = 0, flags;
+
+    if (!TEST_true(named != NULL && custom != NULL && same != NULL
+                   && yn != NULL && yc != NULL && g != NULL)
+        || !TEST_true(BN_set_word(yn, 4) && BN_set_word(yc, 4))
+        || !TEST_true(BN_set_word(g, 5))
+        || !TEST_true((gn = ossl_dh_validate_group(named, &flags)) != NULL))
+        goto err;
+    named = NULL;
+    raw = custom;
+    if (!TEST_true((gc = ossl_dh_validate_group(custom, &flags)) != NULL))
+        goto err;
+    custom = NULL;
+    if (!TEST_true((gs = ossl_dh_validate_group(same, &flags)) != NULL))
+        goto err;
+    same = NULL;
+
+    /* ephemeral in a safe-prime named group: partial; static: full */
+    if (!TEST_true((kn = ossl_dh_validate_pub_key(gn, yn, DH_KEY_USAGE_EPHEMERAL,
+                                                  &flags)) != NULL))
+        goto err;
+    yn = NULL;
+    if (!TEST_true((kc = ossl_dh_validate_pub_key(gc, yc, DH_KEY_USAGE_STATIC,
+                                                  &flags)) != NULL))
+        goto err;
+    yc = NULL;
+
+    if (!TEST_true(ossl_dh_validated_pub_key_get0(kn, gn,
+                                                  DH_PUBKEY_CHECK_PARTIAL) != NULL)
+        || !TEST_true(ossl_dh_validated_pub_key_get0(kn, gn,
+                                                     DH_PUBKEY_CHECK_FULL) == NULL)
+        || !TEST_true(ossl_dh_validated_pub_key_get0(kc, gc,
+                                                     DH_PUBKEY_CHECK_FULL) != NULL)
+        || !TEST_true(ossl_dh_validated_pub_key_get0(kc, gn,
+                                                     DH_PUBKEY_CHECK_PARTIAL) == NULL))
+        goto err;
+    /* Bound to the values, not to the handle's address */
+    if (!TEST_true(ossl_dh_validated_pub_key_get0(kc, gs,
+                                                  DH_PUBKEY_CHECK_FULL) != NULL))
+        goto err;
+
+    /* Changing the group through a pointer kept from before */
+    if (!TEST_true(DH_set0_pqg(raw, NULL, NULL, g)))
+        goto err;
+    g = NULL;
+    if (!TEST_true(ossl_dh_validated_group_get0_dh(gc) == NULL)
+        || !TEST_true(ossl_dh_validated_pub_key_get0(kc, gc,
+                                                     DH_PUBKEY_CHECK_FULL) == NULL)
+        || !TEST_true(ossl_dh_validated_group_get0_dh(gs) != NULL))
+        goto err;
+    ERR_clear_error();
+    ok = 1;
+ err:
+    ossl_dh_validated_pub_key_free(kn);
+    ossl_dh_validated_pub_key_free(kc);
+    ossl_dh_validated_group_free(gn);
+    ossl_dh_validated_group_free(gc);
+    ossl_dh_validated_group_free(gs);
+    BN_free(yn);
+    BN_free(yc);
+    BN_free(g);
+    DH_free(named);
+    DH_free(custom);
+    DH_free(same);
+    return ok;
+}
+
+/*
+ * The policy validates ephemeral keys in a named safe-prime group partially
+ * and everything else fully. p - 2 tells the levels apart: it is in range,
+ * but not in the order q subgroup.
+ */
+static int test_pub_key_policy(void)
+{
+    static const struct {
+        int named, usage, level;
+    } cases[] = {
+        { 1, DH_KEY_USAGE_EPHEMERAL, DH_PUBKEY_CHECK_PARTIAL },
+        { 1, DH_KEY_USAGE_STATIC, DH_PUBKEY_CHECK_FULL },
+        { 0, DH_KEY_USAGE_EPHEMERAL, DH_PUBKEY_CHECK_FULL },
+        { 0, DH_KEY_USAGE_STATIC, DH_PUBKEY_CHECK_FULL },
+    };
+    DH *named = DH_new_by_nid(NID_ffdhe2048), *custom = make_oakley1024(4, 1);
+    BIGNUM *y[2] = { NULL, NULL };
+    const DH *dh;
+    const BIGNUM *key;
+    size_t i;
+    int ok = 0, level, ret, flags, ref, ref_flags;
+
+    if (!TEST_true(named != NULL && custom != NULL)
+        || !TEST_true((y[0] = BN_dup(DH_get0_p(named))) != NULL
+                      && (y[1] = BN_dup(DH_get0_p(custom))) != NULL)
+        || !TEST_true(BN_sub_word(y[0], 2) && BN_sub_word(y[1], 2)))
+        goto err;
+    for (i = 0; i < OSSL_NELEM(cases); i++) {
+        dh = cases[i].named ? named : custom;
+        key = y[!cases[i].named];
+        level = 0;
+        ret = ossl_dh_check_pub_key_policy(dh, key, cases[i].usage, &level,
+                                           &flags);
+        if (cases[i].level == DH_PUBKEY_CHECK_PARTIAL)
+            ref = ossl_dh_check_pub_key_partial(dh, key, &ref_flags);
+        else
+            ref = DH_check_pub_key(dh, key, &ref_flags);
+        /* Only the partial check accepts p - 2 */
+        if (!TEST_true(level == cases[i].level)
+            || !TEST_true(ret == ref && flags == ref_flags)
+            || !TEST_true((ret && flags == 0)
+                          == (level == DH_PUBKEY_CHECK_PARTIAL))) {
+            fprintf(stderr, "# case %zu: level %d, flags 0x%x\n", i, level,
+                    (unsigned int)flags);
+            goto err;
+        }
+    }
+    if (!TEST_true(!ossl_dh_check_pub_key_policy(named, y[0], 0, &level,
+                                                 &ret)))
+        goto err;
+    ERR_clear_error();
+    ok = 1;
+ err:
+    BN_free(y[0]);
+    BN_free(y[1]);
+    DH_free(named);
+    DH_free(custom);
+    return ok;
+}
+
+/*
+ * Every flag ossl_dh_check_pub_key_partial_batch() gives equals the flag
+ * ossl_dh_check_pub_key_partial() gives for the same key as a BIGNUM: 0, 1,
+ * 2, p - 2, p - 1, p and all ones, at the width of p and one byte wider,
+ * where 2^(8 * BN_num_bytes(p)) + 2 is the oversized key.
+ */
+static int test_batch_matches_partial(void)
+{
+    DH *dh = DH_new_by_nid(NID_ffdhe2048);
+    BIGNUM *vals[8] = { NULL }, *bn = NULL;
+    unsigned char *keys = NULL, flags[OSSL_NELEM(vals)];
+    const BIGNUM *p;
+    size_t i, n, extra, keylen;
+    int ok = 0, ret;
+
+    if (!TEST_true(dh != NULL))
+        goto err;
+    p = DH_get0_p(dh);
+    n = (size_t)BN_num_bytes(p);
+    for (i = 0; i < OSSL_NELEM(vals); i++)
+        if (!TEST_true((vals[i] = BN_new()) != NULL))
+            goto err;
+    BN_zero(vals[0]);
+    if (!TEST_true(BN_one(vals[1]))
+        || !TEST_true(BN_set_word(vals[2], 2))
+        || !TEST_true(BN_sub(vals[3], p, vals[2]))
+        || !TEST_true(BN_sub(vals[4], p, vals[1]))
+        || !TEST_true(BN_copy(vals[5], p) != NULL)
+        || !TEST_true(BN_set_bit(vals[6], (int)(8 * n)))
+        || !TEST_true(BN_sub_word(vals[6], 1))
+        || !TEST_true(BN_set_bit(vals[7], (int)(8 * n)))
+        || !TEST_true(BN_add_word(vals[7], 2)))
+        goto err;
+
+    for (extra = 0; extra <= 1; extra++) {
+        keylen = n + extra;
+        OPENSSL_free(keys);
+        if (!TEST_true((keys = OPENSSL_malloc(keylen * OSSL_NELEM(vals)))
+                       != NULL))
+            goto err;
+        /* The oversized key only fits the wider width */
+        for (i = 0; i < OSSL_NELEM(vals) - 1 + extra; i++)
+            if (!TEST_true(BN_bn2binpad(vals[i], keys + i * keylen,
+                                        (int)keylen) >= 0))
+                goto err;
+        if (!TEST_true(ossl_dh_check_pub_key_partial_batch(dh, keys, keylen,
+                                                           i, flags)))
+            goto err;
+        while (i-- > 0) {
+            BN_free(bn);
+            if (!TEST_true((bn = BN_bin2bn(keys + i * keylen, (int)keylen,
+                                           NULL)) != NULL))
+                goto err;
+            ret = -1;
+            ossl_dh_check_pub_key_partial(dh, bn, &ret);
+            if (!TEST_true(flags[i] == ret)) {
+                fprintf(stderr, "# key %zu, width %zu: batch %d, partial %d\n",
+                        i, keylen, flags[i], ret);
+                goto err;
+            }
+        }
+    }
+    ok = 1;
+ err:
+    for (i = 0; i < OSSL_NELEM(vals); i++)
+        BN_free(vals[i]);
+    BN_free(bn);
+    OPENSSL_free(keys);
+    DH_free(dh);
+    return ok;
+}
+
+/*
+ * A streamed key fed one byte at a time is rejected as too large on the
+ * first byte that differs from p - 2 upwards, and not before; every later
+ * call repeats the verdict. The final verdict, fed bytewise or in one piece,
+ * equals ossl_dh_check_pub_key_partial() for the keys of
+ * test_batch_matches_partial().
+ */
+static int test_stream_matches_partial(void)
+{
+    DH *dh = DH_new_by_nid(NID_ffdhe2048);
+    BIGNUM *vals[8] = { NULL }, *bn = NULL, *bound = NULL;
+    unsigned char key[OPENSSL_DH_MAX_MODULUS_BITS / 8 + 1];
+    unsigned char bbuf[sizeof(key)];
+    DH_PUB_KEY_STREAM st;
+    const BIGNUM *p;
+    size_t i, j, n, extra, keylen, reject;
+    int ok = 0, ret, ref, fed, flags;
+
+    if (!TEST_true(dh != NULL))
+        goto err;
+    p = DH_get0_p(dh);
+    n = (size_t)BN_num_bytes(p);
+    for (i = 0; i < OSSL_NELEM(vals); i++)
+        if (!TEST_true((vals[i] = BN_new()) != NULL))
+            goto err;
+    BN_zero(vals[0]);
+    if (!TEST_true((bound = BN_dup(p)) != NULL)
+        || !TEST_true(BN_sub_word(bound, 2))
+        || !TEST_true(BN_one(vals[1]))
+        || !TEST_true(BN_set_word(vals[2], 2))
+        || !TEST_true(BN_copy(vals[3], bound) != NULL)
+        || !TEST_true(BN_sub(vals[4], p, vals[1]))
+        || !TEST_true(BN_copy(vals[5], p) != NULL)
+        || !TEST_true(BN_set_bit(vals[6], (int)(8 * n)))
+        || !TEST_true(BN_sub_word(vals[6], 1))
+        || !TEST_true(BN_set_bit(vals[7], (int)(8 * n)))
+        || !TEST_true(BN_add_word(vals[7], 2)))
+        goto err;
+
+    for (extra = 0; extra <= 1; extra++) {
+        keylen = n + extra;
+        if (!TEST_true(BN_bn2binpad(bound, bbuf, (int)keylen) >= 0))
+            goto err;
+        /* The oversized key only fits the wider width */
+        for (i = 0; i < OSSL_NELEM(vals) - 1 + extra; i++) {
+            BN_free(bn);
+            bn = NULL;
+            if (!TEST_true(BN_bn2binpad(vals[i], key, (int)keylen) >= 0)
+                || !TEST_true((bn = BN_bin2bn(key, (int)keylen, NULL))
+                              != NULL))
+                goto err;
+            ref = ret = -1;
+            ossl_dh_check_pub_key_partial(dh, bn, &ref);
+            /* The byte that settles key > p - 2, or keylen if it is not */
+            for (reject = 0; reject < keylen && key[reject] == bbuf[reject];
+                 reject++)
+                continue;
+            if (reject < keylen && key[reject] < bbuf[reject])
+                reject = keylen;
+
+            if (!TEST_true(ossl_dh_pub_key_stream_init(&st, dh, keylen)))
+                goto err;
+            for (j = 0, fed = 1; j < keylen && fed; j++)
+                fed = ossl_dh_pub_key_stream_feed(&st, key + j, 1, &flags);
+            if (!TEST_true(fed ? reject == keylen
+                               : reject == j - 1
+                                 && flags == DH_CHECK_PUBKEY_TOO_LARGE)
+                || !TEST_true(fed
+                              || (!ossl_dh_pub_key_stream_feed(&st, key, 0,
+                                                               &ret)
+                                  && ret == flags))
+                || !TEST_true(ossl_dh_pub_key_stream_final(&st, &ret)
+                              == (ref == 0) && ret == ref))
+                goto stream_err;
+
+            if (!TEST_true(ossl_dh_pub_key_stream_init(&st, dh, keylen))
+                || !TEST_true(ossl_dh_pub_key_stream_feed(&st, key, keylen,
+                                                          &flags)
+                              == (reject == keylen))
+                || !TEST_true(ossl_dh_pub_key_stream_final(&st, &ret)
+                              == (ref == 0) && ret == ref))
+                goto stream_err;
+            continue;
+ stream_err:
+            fprintf(stderr, "# key %zu, width %zu: byte %zu, stream %d, "
+                    "partial %d\n", i, keylen, j, ret, ref);
+            goto err;
+        }
+    }
+    /* More bytes than announced */
+    if (!TEST_true(ossl_dh_pub_key_stream_init(&st, dh, n))
+        || !TEST_true(!ossl_dh_pub_key_stream_feed(&st, key, n + 1, &ret)))
+        goto err;
+    ERR_clear_error();
+    ok = 1;
+ err:
+    for (i = 0; i < OSSL_NELEM(vals); i++)
+        BN_free(vals[i]);
+    BN_free(bn);
+    BN_free(bound);
+    DH_free(dh);
+    return ok;
+}
+
+/*
+ * Calls of every profiled phase so far, summed over the size buckets.
+ * Returns 0 when the profile is not compiled in.
+ */
+static int prof_calls(uint64_t calls[DH_CHECK_PROF_NPHASES])
+{
+    DH_CHECK_PROF_STATS st;
+    int phase, size;
+
+    for (phase = 0; phase < DH_CHECK_PROF_NPHASES; phase++) {
+        calls[phase] = 0;
+        for (size = 0; size < DH_CHECK_PROF_NSIZES; size++) {
+            if (!ossl_dh_check_prof_get(phase, size, &st))
+                return 0;
+            calls[phase] += st.calls;
+        }
+    }
+    return 1;
+}
+
+/*
+ * With the profile compiled in, every phase counts its calls in the bucket
+ * of the modulus size and nowhere else, and a reset clears the table:
+ * twice DH_check() on a custom 1024-bit group with q, once on the same
+ * group without q, once on a named 2048-bit group (no phase at all), and
+ * one DH_check_pub_key() on the named group. Without the profile,
+ * ossl_dh_check_prof_get() must report that.
+ */
+static int test_prof_counts(void)
+{
+    uint64_t expect[DH_CHECK_PROF_NPHASES][DH_CHECK_PROF_NSIZES];
+    DH_CHECK_PROF_STATS st;
+    DH *dh = make_oakley1024(4, 1), *dh_noq = make_oakley1024(4, 0);
+    DH *named = DH_new_by_nid(NID_ffdhe2048);
+    BIGNUM *y = BN_new();
+    int ok = 0, phase, size, ret;
+
+    if (!TEST_true(dh != NULL && dh_noq != NULL && named != NULL && y != NULL)
+        || !TEST_true(BN_set_word(y, 4)))
+        goto err;
+    if (!ossl_dh_check_prof_get(DH_CHECK_PROF_PARAMS, 0, &st)) {
+        ok = TEST_true(st.calls == 0);
+        goto err;
+    }
+    if (!TEST_true(!ossl_dh_check_prof_get(DH_CHECK_PROF_NPHASES, 0, &st))
+        || !TEST_true(!ossl_dh_check_prof_get(0, DH_CHECK_PROF_NSIZES, &st)))
+        goto err;
+
+    ossl_dh_check_prof_reset();
+    memset(expect, 0, sizeof(expect));
+    if (!TEST_true(DH_check(dh, &ret)) || !TEST_true(DH_check(dh, &ret))
+        || !TEST_true(DH_check(dh_noq, &ret))
+        || !TEST_true(DH_check(named, &ret))
+        || !TEST_true(DH_check_pub_key(named, y, &ret)))
+        goto err;
+    expect[DH_CHECK_PROF_PARAMS][0] = 3;
+    expect[DH_CHECK_PROF_GENERATOR][0] = 2;
+    expect[DH_CHECK_PROF_Q_PRIME][0] = 2;
+    expect[DH_CHECK_PROF_Q_DIVIDES_P][0] = 2;
+    expect[DH_CHECK_PROF_P_PRIME][0] = 3;
+    expect[DH_CHECK_PROF_P_SAFE_PRIME][0] = 1;
+    expect[DH_CHECK_PROF_PUB_KEY][1] = 1;
+    for (phase = 0; phase < DH_CHECK_PROF_NPHASES; phase++) {
+        for (size = 0; size < DH_CHECK_PROF_NSIZES; size++) {
+            if (!TEST_true(ossl_dh_check_prof_get(phase, size, &st))
+                || !TEST_true(st.calls == expect[phase][size])
+                || !TEST_true(st.calls != 0 || st.ns == 0)) {
+                fprintf(stderr, "# phase %d size %d: %llu calls\n", phase,
+                        size, (unsigned long long)st.calls);
+                goto err;
+            }
+        }
+    }
+    if (!TEST_true(ossl_dh_check_prof_get(DH_CHECK_PROF_P_PRIME, 0, &st))
+        || !TEST_true(st.ns > 0))
+        goto err;
+
+    ossl_dh_check_prof_reset();
+    for (phase = 0; phase < DH_CHECK_PROF_NPHASES; phase++)
+        for (size = 0; size < DH_CHECK_PROF_NSIZES; size++)
+            if (!TEST_true(ossl_dh_check_prof_get(phase, size, &st))
+                || !TEST_true(st.calls == 0 && st.ns == 0))
+                goto err;
+    ok = 1;
+ err:
+    BN_free(y);
+    DH_free(dh);
+    DH_free(dh_noq);
+    DH_free(named);
+    return ok;
+}
+
+/*
+ * Run ossl_dh_check_cached() and compare its flags with DH_check(). With
+ * the profile compiled in, also check which expensive phases it ran: one
+ * bit per DH_CHECK_PROF_* phase in |phases|.
+ */
+static int cached_step(const DH *dh, DH_CHECK_CACHE *cache,
+                       unsigned int phases)
+{
+    static const int expensive[] = {
+        DH_CHECK_PROF_GENERATOR, DH_CHECK_PROF_Q_PRIME,
+        DH_CHECK_PROF_P_PRIME, DH_CHECK_PROF_P_SAFE_PRIME
+    };
+    uint64_t before[DH_CHECK_PROF_NPHASES], after[DH_CHECK_PROF_NPHASES];
+    int have_prof, ret, ref;
+    size_t i;
+
+    have_prof = prof_calls(before);
+    if (!TEST_true(ossl_dh_check_cached(dh, cache, &ret)))
+        return 0;
+    if (have_prof && prof_calls(after))
+        for (i = 0; i < OSSL_NELEM(expensive); i++) {
+            int phase = expensive[i];
+            unsigned int ran = after[phase] != before[phase];
+
+            if (!TEST_true(ran == ((phases >> phase) & 1)))
+                return 0;
+        }
+    return TEST_true(DH_check(dh, &ref)) && TEST_true(ret == ref);
+}
+
+/*
+ * The verdict cache only re-runs the tests a changed component affects: a
+ * new g runs the generator check alone, a new q value never re-tests p,
+ * and the safe prime test comes back when q disappears.
+ */
+static int test_cached_invalidation(void)
+{
+    DH_CHECK_CACHE *cache = ossl_dh_check_cache_new();
+    DH *dh = make_oakley1024(4, 1), *dh_noq = make_oakley1024(4, 0);
+    BIGNUM *g = BN_new(), *q = NULL;
+    int ok = 0;
+
+    if (!TEST_true(cache != NULL && dh != NULL && dh_noq != NULL && g != NULL)
+        || !TEST_true(cached_step(dh, cache,
+                                  1 << DH_CHECK_PROF_GENERATOR
+                                  | 1 << DH_CHECK_PROF_Q_PRIME
+                                  | 1 << DH_CHECK_PROF_P_PRIME))
+        || !TEST_true(cached_step(dh, cache, 0))
+        || !TEST_true(BN_set_word(g, 16))
+        || !TEST_true(DH_set0_pqg(dh, NULL, NULL, g)))
+        goto err;
+    g = NULL;
+    if (!TEST_true(cached_step(dh, cache, 1 << DH_CHECK_PROF_GENERATOR))
+        || !TEST_true((q = BN_dup(DH_get0_q(dh))) != NULL)
+        || !TEST_true(BN_sub_word(q, 2))
+        || !TEST_true(DH_set0_pqg(dh, NULL, q, NULL)))
+        goto err;
+    q = NULL;
+    if (!TEST_true(cached_step(dh, cache,
+                               1 << DH_CHECK_PROF_GENERATOR
+                               | 1 << DH_CHECK_PROF_Q_PRIME))
+        || !TEST_true(cached_step(dh_noq, cache,
+                                  1 << DH_CHECK_PROF_P_SAFE_PRIME)))
+        goto err;
+    ok = 1;
+ err:
+    BN_free(g);
+    BN_free(q);
+    DH_free(dh);
+    DH_free(dh_noq);
+    ossl_dh_check_cache_free(cache);
+    return ok;
+}
+
+/* DH_check() flags that the DH_CHECK_MASK_* tests in |checks| report */
+static int mask_flags(unsigned int checks)
+{
+    static const struct {
+        unsigned int check;
+        int flag;
+    } map[] = {
+        { DH_CHECK_MASK_GENERATOR, DH_NOT_SUITABLE_GENERATOR },
+        { DH_CHECK_MASK_Q_PRIME, DH_CHECK_Q_NOT_PRIME },
+        { DH_CHECK_MASK_Q_DIVIDES_P, DH_CHECK_INVALID_Q_VALUE },
+        { DH_CHECK_MASK_J, DH_CHECK_INVALID_J_VALUE },
+        { DH_CHECK_MASK_P_PRIME, DH_CHECK_P_NOT_PRIME },
+        { DH_CHECK_MASK_P_SAFE_PRIME, DH_CHECK_P_NOT_SAFE_PRIME },
+    };
+    size_t i;
+    int flags = 0;
+
+    for (i = 0; i < OSSL_NELEM(map); i++)
+        if ((checks & map[i].check) != 0)
+            flags |= map[i].flag;
+    return flags;
+}
+
+/*
+ * Every subset of the DH_check() tests reports exactly the DH_check() flags
+ * of the tests it selects, plus the structural flags that always run. The
+ * groups fail the generator, q, p and safe prime tests in turn; the Oakley
+ * group with g = 2 comes from the known-group table.
+ */
+static int test_mask_subsets(void)
+{
+    DH *dh[5] = { NULL };
+    static const int expect[OSSL_NELEM(dh)] = {
+        0,
+        DH_NOT_SUITABLE_GENERATOR | DH_CHECK_Q_NOT_PRIME
+            | DH_CHECK_INVALID_Q_VALUE,
+        DH_CHECK_P_NOT_PRIME,
+        DH_CHECK_P_NOT_SAFE_PRIME,
+        DH_MODULUS_TOO_SMALL,
+    };
+    BIGNUM *p = NULL, *q = NULL, *g = NULL, *add = NULL, *rem = NULL;
+    unsigned int checks, run;
+    size_t i;
+    int ok = 0, full, params, ret;
+
+    dh[0] = make_oakley1024(4, 1);
+    dh[1] = make_oakley1024(4, 1);
+    dh[2] = make_oakley1024(4, 0);
+    dh[3] = DH_new();
+    dh[4] = make_oakley1024(2, 0);
+    if (!TEST_true(dh[0] != NULL && dh[1] != NULL && dh[2] != NULL
+                   && dh[3] != NULL && dh[4] != NULL)
+        /* q - 2 is neither prime nor a divisor of p - 1 */
+        || !TEST_true((q = BN_dup(DH_get0_q(dh[1]))) != NULL)
+        || !TEST_true(BN_sub_word(q, 2))
+        || !TEST_true(DH_set0_pqg(dh[1], NULL, q, NULL)))
+        goto err;
+    q = NULL;
+    /* p + 2 is odd and composite */
+    if (!TEST_true((p = BN_dup(DH_get0_p(dh[2]))) != NULL)
+        || !TEST_true(BN_add_word(p, 2))
+        || !TEST_true(DH_set0_pqg(dh[2], p, NULL, NULL)))
+        goto err;
+    /* A prime p = 1 mod 4 has an even (p - 1) / 2 */
+    if (!TEST_true((p = BN_new()) != NULL && (g = BN_new()) != NULL
+                   && (add = BN_new()) != NULL && (rem = BN_new()) != NULL)
+        || !TEST_true(BN_set_word(add, 4) && BN_set_word(rem, 1)
+                      && BN_set_word(g, 2))
+        || !TEST_true(BN_generate_prime_ex(p, 512, 0, add, rem, NULL))
+        || !TEST_true(DH_set0_pqg(dh[3], p, NULL, g)))
+        goto err;
+    p = g = NULL;
+
+    for (i = 0; i < OSSL_NELEM(dh); i++) {
+        if (!TEST_true(DH_check(dh[i], &full) && full == expect[i])
+            || !TEST_true(DH_check_params(dh[i], &params)))
+            goto err;
+        params |= DH_MODULUS_TOO_SMALL | DH_MODULUS_TOO_LARGE;
+        for (checks = 0; checks <= DH_CHECK_MASK_ALL; checks++) {
+            run = checks;
+            if ((run & DH_CHECK_MASK_P_SAFE_PRIME) != 0)
+                run |= DH_CHECK_MASK_P_PRIME;
+            if (!TEST_true(ossl_dh_check_mask(dh[i], checks, &ret))
+                || !TEST_true(ret == (full & (mask_flags(run) | params)))) {
+                fprintf(stderr, "# group %zu mask 0x%02x: 0x%x\n", i, checks,
+                        (unsigned int)ret);
+                goto err;
+            }
+        }
+    }
+    if (!TEST_true(!ossl_dh_check_mask(dh[0], DH_CHECK_MASK_ALL + 1, &ret)))
+        goto err;
+    ERR_clear_error();
+    ok = 1;
+ err:
+    BN_free(p);
+    BN_free(q);
+    BN_free(g);
+    BN_free(add);
+    BN_free(rem);
+    for (i = 0; i < OSSL_NELEM(dh); i++)
+        DH_free(dh[i]);
+    return ok;
+}
+
+/*
+ * Reload |groups| on top of |prev| and check the verdicts against DH_check()
+ * and the work done: |carried| verdicts reused, |checked| groups validated,
+ * and with the profile compiled in, |primes| primality tests of p, one per
+ * checked group that is not answered from the known-group table.
+ */
+static DH_CHECK_SET *reload_step(const DH_CHECK_SET *prev, DH **groups,
+                                 size_t ngroups, DH_CHECK_EXECUTOR *executor,
+                                 size_t carried, size_t checked,
+                                 uint64_t primes)
+{
+    uint64_t before[DH_CHECK_PROF_NPHASES], after[DH_CHECK_PROF_NPHASES];
+    DH_CHECK_SET *set;
+    size_t i, ncarried, nchecked;
+    int have_prof, ok, ret, ref;
+
+    have_prof = prof_calls(before);
+    if (!TEST_true((set = ossl_dh_check_reload(prev, groups, ngroups,
+                                               executor)) != NULL))
+        return NULL;
+    if (have_prof && prof_calls(after)
+        && !TEST_true(after[DH_CHECK_PROF_P_PRIME]
+                      - before[DH_CHECK_PROF_P_PRIME] == primes))
+        goto err;
+    ossl_dh_check_set_get_counts(set, &ncarried, &nchecked);
+    if (!TEST_true(ncarried == carried && nchecked == checked))
+        goto err;
+    for (i = 0; i < ngroups; i++) {
+        ok = ossl_dh_check_set_get(set, i, &ret);
+        if (!TEST_true(ok == DH_check(groups[i], &ref) && ret == ref))
+            goto err;
+    }
+    return set;
+ err:
+    ossl_dh_check_set_free(set);
+    return NULL;
+}
+
+/*
+ * A reload carries the verdicts of groups whose values did not change,
+ * even in new DH objects, and validates changed and new groups, on the
+ * calling thread and on an executor alike. The Oakley group with g = 2 is a
+ * known-group table hit and costs no primality test.
+ */
+static int test_reload(void)
+{
+    DH *first[3] = { NULL }, *second[4] = { NULL };
+    DH_CHECK_SET *set1 = NULL, *set2 = NULL;
+    DH_CHECK_EXECUTOR *executor = NULL;
+    size_t i;
+    int ok = 0, pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+#ifdef TEST_EXECUTOR
+            if (!TEST_true((executor = ossl_dh_check_executor_new(2, NULL, 0,
+                                                                  0)) != NULL))
+                goto err;
+#else
+            break;
+#endif
+        }
+        first[0] = make_oakley1024(4, 1);
+        first[1] = make_oakley1024(4, 0);
+        first[2] = make_oakley1024(2, 1);
+        /* Same values as first[0] and first[2], changed g, a new group */
+        second[0] = make_oakley1024(4, 1);
+        second[1] = make_oakley1024(16, 0);
+        second[2] = make_oakley1024(2, 1);
+        second[3] = make_oakley1024(9, 1);
+        for (i = 0; i < OSSL_NELEM(first); i++)
+            if (!TEST_true(first[i] != NULL))
+                goto err;
+        for (i = 0; i < OSSL_NELEM(second); i++)
+            if (!TEST_true(second[i] != NULL))
+                goto err;
+
+        if ((set1 = reload_step(NULL, first, OSSL_NELEM(first), executor,
+                                0, 3, 2)) == NULL
+            || (set2 = reload_step(set1, second, OSSL_NELEM(second), executor,
+                                   2, 2, 2)) == NULL)
+            goto err;
+        /* Nothing changed: no validation at all */
+        ossl_dh_check_set_free(set1);
+        if ((set1 = reload_step(set2, second, OSSL_NELEM(second), executor,
+                                4, 0, 0)) == NULL)
+            goto err;
+
+        ossl_dh_check_set_free(set1);
+        ossl_dh_check_set_free(set2);
+        set1 = set2 = NULL;
+        for (i = 0; i < OSSL_NELEM(first); i++) {
+            DH_free(first[i]);
+            first[i] = NULL;
+        }
+        for (i = 0; i < OSSL_NELEM(second); i++) {
+            DH_free(second[i]);
+            second[i] = NULL;
+        }
+    }
+    ok = 1;
+ err:
+    ossl_dh_check_set_free(set1);
+    ossl_dh_check_set_free(set2);
+    for (i = 0; i < OSSL_NELEM(first); i++)
+        DH_free(first[i]);
+    for (i = 0; i < OSSL_NELEM(second); i++)
+        DH_free(second[i]);
+#ifdef TEST_EXECUTOR
+    ossl_dh_check_executor_free(executor);
+#endif
+    return ok;
+}
+
+/* ASYNC_start_job() body: ossl_dh_check_async() on the DH in |arg| */
+typedef struct async_check_st {
+    const DH *dh;
+    int ok, flags;
+} ASYNC_CHECK;
+
+static int async_check_run(void *arg)
+{
+    ASYNC_CHECK *c = *(ASYNC_CHECK **)arg;
+
+    c->ok = ossl_dh_check_async(c->dh, &c->flags);
+    return 1;
+}
+
+/* Drive |fn| to completion inside an ASYNC_JOB, counting the pauses */
+static int async_drive(int (*fn)(void *), void *arg, size_t argsize,
+                       size_t *npauses)
+{
+    ASYNC_WAIT_CTX *wctx = ASYNC_WAIT_CTX_new();
+    ASYNC_JOB *job = NULL;
+    int ret = 0, res = 0;
+
+    *npauses = 0;
+    if (wctx == NULL)
+        return 0;
+    for (;;) {
+        res = ASYNC_start_job(&job, wctx, &ret, fn, arg, argsize);
+        if (res != ASYNC_PAUSE)
+            break;
+        ++*npauses;
+    }
+    ASYNC_WAIT_CTX_free(wctx);
+    return res == ASYNC_FINISH && ret == 1;
+}
+
+/* DH_CHECK_EXECUTOR_FN that runs every job inside its own ASYNC_JOB */
+typedef struct async_executor_st {
+    size_t npauses;
+    int refuse;
+} ASYNC_EXECUTOR;
+
+typedef struct async_executor_call_st {
+    void (*run)(void *);
+    void *run_arg;
+} ASYNC_EXECUTOR_CALL;
+
+static int async_executor_call(void *arg)
+{
+    ASYNC_EXECUTOR_CALL *call = arg;
+
+    call->run(call->run_arg);
+    return 1;
+}
+
+static int async_executor(void (*run)(void *), void *run_arg,
+                          void *executor_arg)
+{
+    ASYNC_EXECUTOR *e = executor_arg;
+    ASYNC_EXECUTOR_CALL call;
+
+    if (e->refuse)
+        return 0;
+    call.run = run;
+    call.run_arg = run_arg;
+    return async_drive(async_executor_call, &call, sizeof(call), &e->npauses);
+}
+
+static void count_done(DH_CHECK_JOB *job, void *arg)
+{
+    ++*(int *)arg;
+}
+
+/*
+ * ossl_dh_check_async() gives DH_check()'s result whether it runs inside
+ * an ASYNC_JOB or not, and inside one it pauses between primality rounds.
+ * ossl_dh_check_job_submit() runs jobs inline or on a pluggable executor,
+ * calls done exactly once per accepted job, and never for a refused job or
+ * an unknown job type.
+ */
+static int test_async(void)
+{
+    DH *dh = make_oakley1024(4, 1);
+    BIGNUM *y = BN_new();
+    ASYNC_CHECK c, *cp = &c;
+    ASYNC_EXECUTOR e = { 0, 0 };
+    DH_CHECK_JOB job;
+    size_t npauses;
+    int ok = 0, ref, ref_ret, ret, ndone = 0;
+
+    if (!TEST_true(dh != NULL && y != NULL)
+        || !TEST_true(BN_set_word(y, 4))
+        || !TEST_true((ref_ret = DH_check(dh, &ref)) == 1)
+        || !TEST_true(ossl_dh_check_async(dh, &ret) == ref_ret && ret == ref))
+        goto err;
+
+    c.dh = dh;
+    c.ok = -1;
+    if (ASYNC_is_capable()) {
+        if (!TEST_true(async_drive(async_check_run, &cp, sizeof(cp),
+                                   &npauses))
+            || !TEST_true(c.ok == ref_ret && c.flags == ref)
+            || !TEST_true(npauses > 0))
+            goto err;
+    }
+
+    /* Inline */
+    ossl_dh_check_job_init(&job, DH_CHECK_JOB_PUB_KEY, dh, y, count_done,
+                           &ndone);
+    if (!TEST_true(ossl_dh_check_job_submit(&job, NULL, NULL))
+        || !TEST_true(ndone == 1)
+        || !TEST_true(ossl_dh_check_job_result(&job, &ret)
+                      == DH_check_pub_key(dh, y, &ref) && ret == ref))
+        goto err;
+
+    /* Through an executor that runs it as an ASYNC_JOB */
+    ossl_dh_check_job_init(&job, DH_CHECK_JOB_PARAMS, dh, NULL, count_done,
+                           &ndone);
+    if (!TEST_true(ossl_dh_check_job_submit(&job, async_executor, &e))
+        || !TEST_true(ndone == 2)
+        || !TEST_true(ossl_dh_check_job_result(&job, &ret) == ref_ret)
+        || !TEST_true(DH_check(dh, &ref) && ret == ref)
+        || !TEST_true(!ASYNC_is_capable() || e.npauses > 0))
+        goto err;
+
+    /* Refused by the executor, and an unknown type: done never runs */
+    e.refuse = 1;
+    if (!TEST_true(!ossl_dh_check_job_submit(&job, async_executor, &e)))
+        goto err;
+    ossl_dh_check_job_init(&job, 0, dh, NULL, count_done, &ndone);
+    if (!TEST_true(!ossl_dh_check_job_submit(&job, NULL, NULL))
+        || !TEST_true(ndone == 2))
+        goto err;
+    ERR_clear_error();
+    ok = 1;
+ err:
+    BN_free(y);
+    DH_free(dh);
+    return ok;
+}
+
+#ifdef TEST_EXECUTOR
+/* Where and at which nice value an executor worker ran a probe */
+typedef struct worker_probe_st {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    unsigned int cpu;
+    int nice;
+} WORKER_PROBE;
+
+static void worker_probe_run(void *arg)
+{
+    WORKER_PROBE *w = arg;
+    unsigned int cpu = 0;
+    int nice = 0;
+
+# ifdef TEST_PLACEMENT
+    syscall(SYS_getcpu, &cpu, NULL, NULL);
+    nice = getpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid));
+# endif
+    pthread_mutex_lock(&w->lock);
+    w->cpu = cpu;
+    w->nice = nice;
+    w->done = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Completion callback of a job handed to the executor by job_submit */
+static void worker_probe_job_done(DH_CHECK_JOB *job, void *arg)
+{
+    worker_probe_run(arg);
+}
+
+/*
+ * Start |w|, hand it to |executor| with |submit| and wait for it to be
+ * signalled. Returns 0 if the work was refused.
+ */
+static int worker_probe_wait(WORKER_PROBE *w, int (*submit)(void *arg),
+                             void *arg)
+{
+    int ok;
+
+    if (pthread_mutex_init(&w->lock, NULL) != 0)
+        return 0;
+    if (pthread_cond_init(&w->cond, NULL) != 0) {
+        pthread_mutex_destroy(&w->lock);
+        return 0;
+    }
+    w->done = 0;
+    if ((ok = submit(arg)) != 0) {
+        pthread_mutex_lock(&w->lock);
+        while (!w->done)
+            pthread_cond_wait(&w->cond, &w->lock);
+        pthread_mutex_unlock(&w->lock);
+    }
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    return ok;
+}
+
+typedef struct worker_probe_submit_st {
+    DH_CHECK_EXECUTOR *executor;
+    WORKER_PROBE *w;
+    DH_CHECK_JOB *job;
+} WORKER_PROBE_SUBMIT;
+
+static int worker_probe_submit(void *arg)
+{
+    WORKER_PROBE_SUBMIT *s = arg;
+
+    return ossl_dh_check_executor_submit(worker_probe_run, s->w, s->executor);
+}
+
+static int worker_probe_job_submit(void *arg)
+{
+    WORKER_PROBE_SUBMIT *s = arg;
+
+    return ossl_dh_check_job_submit(s->job, ossl_dh_check_executor_submit,
+                                    s->executor);
+}
+
+/* Run the probe on one of |executor|'s workers through the submit entry */
+static int worker_probe(DH_CHECK_EXECUTOR *executor, WORKER_PROBE *w)
+{
+    WORKER_PROBE_SUBMIT s;
+
+    s.executor = executor;
+    s.w = w;
+    s.job = NULL;
+    return worker_probe_wait(w, worker_probe_submit, &s);
+}
+
+/*
+ * A worker counts a job as completed after the waiter has its result, so
+ * wait up to a second for the counter to catch up.
+ */
+static int executor_completed(DH_CHECK_EXECUTOR *executor, uint64_t n,
+                              DH_CHECK_EXECUTOR_STATS *stats)
+{
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        ossl_dh_check_executor_get_stats(executor, stats);
+        if (stats->completed >= n)
+            return stats->completed == n;
+        usleep(1000);
+    }
+    return 0;
+}
+
+/*
+ * The executor runs submitted work, single jobs and batches with the same
+ * results as the synchronous calls, and its statistics count them.
+ * Affinity and nice values are applied to the workers, and a CPU set the
+ * process may not use makes creation fail. Without placement support
+ * asking for either fails.
+ */
+static int test_executor(void)
+{
+    DH_CHECK_EXECUTOR *executor = NULL;
+    DH_CHECK_EXECUTOR_STATS stats;
+    DH *dh = make_oakley1024(4, 1);
+    BIGNUM *y = BN_new(), *priv = BN_new(), *pub = BN_new();
+    BN_CTX *ctx = BN_CTX_new();
+    DH_CHECK_JOB jobs[3];
+    WORKER_PROBE w;
+    WORKER_PROBE_SUBMIT s;
+    int bad_cpu = -1, ok = 0, ret, refs[3], ref_rets[3], i;
+# ifdef TEST_PLACEMENT
+    unsigned long mask[TEST_MASK_WORDS];
+    const size_t bits = 8 * sizeof(unsigned long);
+    int cpu = -1;
+# endif
+
+    if (!TEST_true(dh != NULL && y != NULL && priv != NULL && pub != NULL
+                   && ctx != NULL)
+        || !TEST_true(BN_set_word(y, 4))
+        || !TEST_true(BN_rand(priv, 160, BN_RAND_TOP_ONE, BN_RAND_BOTTOM_ANY))
+        || !TEST_true(BN_mod_exp(pub, DH_get0_g(dh), priv, DH_get0_p(dh),
+                                 ctx))
+        || !TEST_true(DH_set0_key(dh, pub, priv)))
+        goto err;
+    pub = priv = NULL;
+    ref_rets[0] = DH_check(dh, &refs[0]);
+    ref_rets[1] = DH_check_pub_key(dh, y, &refs[1]);
+    ref_rets[2] = ossl_dh_check_pairwise(dh);
+    refs[2] = 0;
+
+    /* Bad configurations */
+    if (!TEST_true(ossl_dh_check_executor_new(0, NULL, 0, 0) == NULL)
+        || !TEST_true(ossl_dh_check_executor_new(1, &bad_cpu, 1, 0) == NULL))
+        goto err;
+    ERR_clear_error();
+
+    if (!TEST_true((executor = ossl_dh_check_executor_new(2, NULL, 0, 0))
+                   != NULL)
+        || !TEST_true(worker_probe(executor, &w)))
+        goto err;
+    /* A job handed over with the executor as a job_submit() executor */
+    ossl_dh_check_job_init(&jobs[0], DH_CHECK_JOB_PARAMS, dh, NULL,
+                           worker_probe_job_done, &w);
+    s.executor = executor;
+    s.w = &w;
+    s.job = &jobs[0];
+    if (!TEST_true(worker_probe_wait(&w, worker_probe_job_submit, &s))
+        || !TEST_true(ossl_dh_check_job_result(&jobs[0], &ret) == ref_rets[0]
+                      && ret == refs[0]))
+        goto err;
+    ossl_dh_check_job_init(&jobs[0], DH_CHECK_JOB_PARAMS, dh, NULL, NULL,
+                           NULL);
+    ossl_dh_check_job_init(&jobs[1], DH_CHECK_JOB_PUB_KEY, dh, y, NULL, NULL);
+    ossl_dh_check_job_init(&jobs[2], DH_CHECK_JOB_PAIRWISE, dh, NULL, NULL,
+                           NULL);
+    for (i = 0; i < 3; i++)
+        if (!TEST_true(ossl_dh_check_executor_run(executor, &jobs[i], &ret)
+                       == ref_rets[i] && ret == refs[i]))
+            goto err;
+    ossl_dh_check_job_init(&jobs[0], DH_CHECK_JOB_PARAMS, dh, NULL, NULL,
+                           NULL);
+    ossl_dh_check_job_init(&jobs[1], DH_CHECK_JOB_PUB_KEY, dh, y, NULL, NULL);
+    ossl_dh_check_job_init(&jobs[2], DH_CHECK_JOB_PAIRWISE, dh, NULL, NULL,
+                           NULL);
+    if (!TEST_true(ossl_dh_check_executor_run_batch(executor, jobs, 3)))
+        goto err;
+    for (i = 0; i < 3; i++)
+        if (!TEST_true(ossl_dh_check_job_result(&jobs[i], &ret) == ref_rets[i]
+                       && ret == refs[i]))
+            goto err;
+    /* The probe, the submitted job, three single jobs and a batch of three */
+    if (!TEST_true(executor_completed(executor, 8, &stats))
+        || !TEST_true(stats.queue_depth == 0 && stats.max_queue_depth >= 1)
+        || !TEST_true(stats.max_wait_us <= stats.total_wait_us))
+        goto err;
+    ossl_dh_check_executor_free(executor);
+    executor = NULL;
+
+# ifdef TEST_PLACEMENT
+    memset(mask, 0, sizeof(mask));
+    if (!TEST_true(syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask) > 0))
+        goto err;
+    for (i = 0; i < TEST_MAX_CPUS; i++) {
+        if ((mask[i / bits] & (1UL << (i % bits))) != 0) {
+            if (cpu < 0)
+                cpu = i;
+        } else if (bad_cpu < 0) {
+            bad_cpu = i;
+        }
+    }
+    /* Pinned to one CPU, at a lower priority */
+    if (!TEST_true(cpu >= 0)
+        || !TEST_true((executor = ossl_dh_check_executor_new(1, &cpu, 1, 5))
+                      != NULL)
+        || !TEST_true(worker_probe(executor, &w))
+        || !TEST_true(w.cpu == (unsigned int)cpu && w.nice == 5))
+        goto err;
+    ossl_dh_check_executor_free(executor);
+    executor = NULL;
+    /* A CPU outside the process's set */
+    if (bad_cpu >= 0
+        && (!TEST_true(ossl_dh_check_executor_new(1, &bad_cpu, 1, 0) == NULL)
+            || !TEST_true(ERR_GET_LIB(ERR_peek_last_error()) == ERR_LIB_SYS)))
+        goto err;
+    ERR_clear_error();
+    /* A higher priority needs privilege: fail, or really apply it */
+    executor = ossl_dh_check_executor_new(1, NULL, 0, -1);
+    if (executor == NULL) {
+        if (!TEST_true(ERR_GET_LIB(ERR_peek_last_error()) == ERR_LIB_SYS))
+            goto err;
+        ERR_clear_error();
+    } else if (!TEST_true(worker_probe(executor, &w) && w.nice == -1)) {
+        goto err;
+    }
+# else
+    bad_cpu = 0;
+    if (!TEST_true(ossl_dh_check_executor_new(1, &bad_cpu, 1, 0) == NULL)
+        || !TEST_true(ossl_dh_check_executor_new(1, NULL, 0, 5) == NULL))
+        goto err;
+    ERR_clear_error();
+# endif
+    ok = 1;
+ err:
+    ossl_dh_check_executor_free(executor);
+    BN_free(y);
+    BN_free(priv);
+    BN_free(pub);
+    BN_CTX_free(ctx);
+    DH_free(dh);
+    return ok;
+}
+#endif
+
+/* Groups, keys and a BN_CTX for the entry points of the profile */
+typedef struct profile_args_st {
+    DH *dh;                         /* custom, with q */
+    DH *dh_noq;                     /* custom, without q */
+    DH *dh_named;                   /* ffdhe2048 with a private key length */
+    BN_CTX *ctx;
+    BIGNUM *priv, *pub;
+    unsigned char keys[2 * 128];
+    unsigned char flags[2];
+} PROFILE_ARGS;
+
+static void profile_args_free(PROFILE_ARGS *a)
+{
+    BN_free(a->priv);
+    BN_free(a->pub);
+    BN_CTX_free(a->ctx);
+    DH_free(a->dh);
+    DH_free(a->dh_noq);
+    DH_free(a->dh_named);
+}
+
+static int profile_args_init(PROFILE_ARGS *a)
+{
+    const size_t keylen = sizeof(a->keys) / 2;
+
+    memset(a, 0, sizeof(*a));
+    a->dh = make_oakley1024(2, 1);
+    a->dh_noq = make_oakley1024(2, 0);
+    a->dh_named = DH_new_by_nid(NID_ffdhe2048);
+    a->ctx = BN_CTX_new();
+    a->priv = BN_new();
+    a->pub = BN_new();
+    if (!TEST_true(a->dh != NULL && a->dh_noq != NULL && a->dh_named != NULL
+                   && a->ctx != NULL && a->priv != NULL && a->pub != NULL)
+        || !TEST_true(BN_num_bytes(DH_get0_p(a->dh)) == (int)keylen)
+        || !TEST_true(DH_set_length(a->dh_named, 225))
+        || !TEST_true(BN_set_word(a->priv, 12345) && BN_set_word(a->pub, 4))) {
+        profile_args_free(a);
+        return 0;
+    }
+    /* key 0 is 4, key 1 is all ones and so too large */
+    memset(a->keys, 0, keylen);
+    a->keys[keylen - 1] = 4;
+    memset(a->keys + keylen, 0xff, keylen);
+    return 1;
+}
+
+/*
+ * Call every entry point of the profile once. The private key check runs
+ * on all three of its paths: q from a custom group, the length of an
+ * approved group, and no q at all.
+ */
+static int profile_calls(PROFILE_ARGS *a)
+{
+    const size_t keylen = sizeof(a->keys) / 2;
+    DH_PUB_KEY_STREAM st;
+    int ret;
+
+    if (!ossl_dh_check_params_ctx(a->dh, a->ctx, &ret) || ret != 0
+        || !ossl_dh_check_priv_key(a->dh, a->priv, &ret)
+        || !ossl_dh_check_priv_key(a->dh_named, a->priv, &ret)
+        || !ossl_dh_check_priv_key(a->dh_noq, a->priv, &ret)
+        || !ossl_dh_check_pub_key_partial_batch(a->dh, a->keys, keylen, 2,
+                                                a->flags)
+        || !ossl_dh_pub_key_stream_init(&st, a->dh, keylen)
+        || !ossl_dh_pub_key_stream_feed(&st, a->keys, keylen, &ret)
+        || !ossl_dh_pub_key_stream_final(&st, &ret))
+        return 0;
+#ifdef OPENSSL_DH_CHECK_NO_ALLOC
+    if (!DH_check_params(a->dh, &ret) || ret != 0
+        || !ossl_dh_check_params_ctx(a->dh, NULL, &ret) || ret != 0
+        || !ossl_dh_check_pub_key_partial(a->dh, a->pub, &ret))
+        return 0;
+#endif
+    return a->flags[0] == 0 && a->flags[1] == DH_CHECK_PUBKEY_TOO_LARGE;
+}
+
+/*
+ * The entry points covered by OPENSSL_DH_CHECK_NO_ALLOC make no heap
+ * allocation once the caller's BN_CTX has served one call. The ones it
+ * does not cover cannot be called in that build at all, see
+ * DH_CHECK_ALLOCATES.
+ */
+static int test_no_alloc(void)
+{
+    PROFILE_ARGS a;
+    int ok = 0, round, res;
+
+    if (!profile_args_init(&a))
+        return 0;
+    for (round = 0; round < 2; round++) {
+        nallocs = 0;
+        counting = round == 1;
+        res = profile_calls(&a);
+        counting = 0;
+        if (!TEST_true(res))
+            goto err;
+    }
+    if (!TEST_true(nallocs == 0))
+        goto err;
+    ok = 1;
+ err:
+    if (!ok)
+        fprintf(stderr, "# %zu allocations\n", nallocs);
+    profile_args_free(&a);
+    return ok;
+}
+
+#ifdef TEST_STACK
+/*
+ * The thread stack the profile is run on, and what it may use of it beyond
+ * an idle thread. The bound covers the OPENSSL_DH_MAX_MODULUS_BITS byte
+ * buffers on the stack plus the BN calls below them.
+ */
+# define TEST_STACK_SIZE    (256 * 1024)
+# define TEST_STACK_BOUND   (16 * 1024)
+# define TEST_STACK_PAINT   0xA5
+
+static unsigned char test_stack[TEST_STACK_SIZE]
+    __attribute__((__aligned__(4096)));
+
+typedef struct stack_run_st {
+    PROFILE_ARGS *args;             /* NULL for an idle thread */
+    int ok;
+} STACK_RUN;
+
+static void *stack_run(void *arg)
+{
+    STACK_RUN *run = arg;
+
+    run->ok = run->args == NULL || profile_calls(run->args);
+    return NULL;
+}
+
+/*
+ * Bytes of test_stack a thread running profile_calls() (or nothing) has
+ * written, found by painting the stack first and looking for the deepest
+ * byte that changed. Stacks grow down on every platform this runs on.
+ */
+static size_t stack_used(PROFILE_ARGS *args, int *ok)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    STACK_RUN run;
+    size_t i;
+
+    run.args = args;
+    run.ok = 0;
+    memset(test_stack, TEST_STACK_PAINT, sizeof(test_stack));
+    if (pthread_attr_init(&attr) != 0)
+        return 0;
+    if (pthread_attr_setstack(&attr, test_stack, sizeof(test_stack)) != 0
+        || pthread_create(&thread, &attr, stack_run, &run) != 0) {
+        pthread_attr_destroy(&attr);
+        return 0;
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    *ok = run.ok;
+    for (i = 0; i < sizeof(test_stack); i++)
+        if (test_stack[i] != TEST_STACK_PAINT)
+            break;
+    return sizeof(test_stack) - i;
+}
+
+/* The profile's entry points stay within TEST_STACK_BOUND of stack */
+static int test_no_alloc_stack(void)
+{
+    PROFILE_ARGS a;
+    size_t idle = 0, used = 0;
+    int ok = 0, idle_ok = 0, run_ok = 0;
+
+    if (!profile_args_init(&a))
+        return 0;
+    /* Warm the BN_CTX up, as test_no_alloc() does */
+    if (!TEST_true(profile_calls(&a)))
+        goto err;
+    idle = stack_used(NULL, &idle_ok);
+    used = stack_used(&a, &run_ok);
+    if (!TEST_true(idle_ok && run_ok)
+        || !TEST_true(idle > 0 && used > idle)
+        || !TEST_true(used - idle <= TEST_STACK_BOUND))
+        goto err;
+    printf("# profile stack use: %zu bytes\n", used - idle);
+    ok = 1;
+ err:
+    if (!ok)
+        fprintf(stderr, "# idle %zu, with profile %zu bytes\n", idle, used);
+    profile_args_free(&a);
+    return ok;
+}
+#endif
+
+/*
+ * A custom group is promoted on the use that reaches the threshold, and the
+ * hot path then gives the flags DH_check_pub_key() and
+ * ossl_dh_check_pairwise() give, for good and bad keys alike. With a caller
+ * BN_CTX a hot public key check allocates nothing.
+ */
+static int test_hot_promotion(void)
+{
+    DH_CHECK_HOT *hot = ossl_dh_check_hot_new(3, 4);
+    DH *dh = make_oakley1024(2, 1), *dh2 = make_oakley1024(2, 1);
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *keys[7] = { NULL }, *priv = BN_new(), *pub = BN_new();
+    const BIGNUM *p;
+    size_t i;
+    int ok = 0, round, res, ret, ref, ref_ret, flags;
+
+    if (!TEST_true(hot != NULL && dh != NULL && dh2 != NULL && ctx != NULL
+                   && priv != NULL && pub != NULL))
+        goto err;
+    p = DH_get0_p(dh);
+    for (i = 0; i < OSSL_NELEM(keys); i++)
+        if (!TEST_true((keys[i] = BN_new()) != NULL))
+            goto err;
+    /* 4, then 0, 1, p - 1, p, p - 4 (-4 is no square as p = 3 mod 4), 2p */
+    BN_zero(keys[1]);
+    if (!TEST_true(BN_set_word(keys[0], 4))
+        || !TEST_true(BN_one(keys[2]))
+        || !TEST_true(BN_sub(keys[3], p, BN_value_one()))
+        || !TEST_true(BN_copy(keys[4], p) != NULL)
+        || !TEST_true(BN_copy(keys[5], p) != NULL)
+        || !TEST_true(BN_sub_word(keys[5], 4))
+        || !TEST_true(BN_lshift1(keys[6], p)))
+        goto err;
+
+    /* Cold for the first two uses, hot from the third */
+    for (i = 1; i <= 3; i++) {
+        res = ossl_dh_check_pub_key_hot(hot, i == 2 ? dh2 : dh, keys[0],
+                                        &flags);
+        if (!TEST_true(res && flags == 0)
+            || !TEST_true(ossl_dh_check_hot_num_promoted(hot) == (i == 3))
+            || !TEST_true((ossl_dh_check_hot_num_replicas(hot) != 0) == (i == 3)))
+            goto err;
+    }
+
+    for (i = 0; i < OSSL_NELEM(keys); i++) {
+        ref_ret = DH_check_pub_key(dh, keys[i], &ref);
+        res = ossl_dh_check_pub_key_hot_ctx(hot, dh2, keys[i], ctx, &flags);
+        if (!TEST_true(res == ref_ret && flags == ref)
+            || !TEST_true((flags != 0) == (i != 0)))
+            goto err;
+    }
+    ERR_clear_error();
+
+    for (round = 0; round < 2; round++) {
+        nallocs = 0;
+        counting = round == 1;
+        res = ossl_dh_check_pub_key_hot_ctx(hot, dh, keys[0], ctx, &ret);
+        counting = 0;
+        if (!TEST_true(res && ret == 0))
+            goto err;
+    }
+    if (!TEST_true(nallocs == 0))
+        goto err;
+
+    if (!TEST_true(BN_rand(priv, 160, BN_RAND_TOP_ONE, BN_RAND_BOTTOM_ANY))
+        || !TEST_true(BN_mod_exp(pub, DH_get0_g(dh), priv, p, ctx))
+        || !TEST_true(DH_set0_key(dh, pub, priv)))
+        goto err;
+    pub = priv = NULL;
+    if (!TEST_true(ossl_dh_check_pairwise(dh))
+        || !TEST_true(ossl_dh_check_pairwise_hot(hot, dh))
+        || !TEST_true(ossl_dh_check_pairwise_hot_ctx(hot, dh, ctx))
+        || !TEST_true(BN_add_word((BIGNUM *)DH_get0_pub_key(dh), 1))
+        || !TEST_true(!ossl_dh_check_pairwise(dh))
+        || !TEST_true(!ossl_dh_check_pairwise_hot(hot, dh)))
+        goto err;
+    if (!TEST_true(ossl_dh_check_hot_num_promoted(hot) == 1))
+        goto err;
+    ok = 1;
+ err:
+    if (!ok)
+        fprintf(stderr, "# %zu allocations\n", nallocs);
+    for (i = 0; i < OSSL_NELEM(keys); i++)
+        BN_free(keys[i]);
+    BN_free(priv);
+    BN_free(pub);
+    BN_CTX_free(ctx);
+    DH_free(dh);
+    DH_free(dh2);
+    ossl_dh_check_hot_free(hot);
+    return ok;
+}
+
+/*
+ * A promoted group gets one replica per NUMA node it is used on: run the
+ * hot check pinned to every CPU this thread may use and count the distinct
+ * nodes getcpu() reports. Without getcpu() every thread is node 0.
+ */
+static int test_hot_replica_per_node(void)
+{
+    DH_CHECK_HOT *hot = ossl_dh_check_hot_new(1, 1);
+    DH *dh = make_oakley1024(2, 1);
+    BIGNUM *y = BN_new();
+    size_t nnodes = 1;
+    int ok = 0, flags;
+#ifdef TEST_PER_NODE
+    unsigned long saved[TEST_MASK_WORDS], mask[TEST_MASK_WORDS];
+    const size_t bits = 8 * sizeof(unsigned long);
+    int seen[DH_CHECK_HOT_MAX_NODES] = { 0 };
+    unsigned int cpu, node;
+    size_t i;
+    long n;
+#endif
+
+    if (!TEST_true(hot != NULL && dh != NULL && y != NULL)
+        || !TEST_true(BN_set_word(y, 4)))
+        goto err;
+#ifdef TEST_PER_NODE
+    nnodes = 0;
+    memset(saved, 0, sizeof(saved));
+    n = syscall(SYS_sched_getaffinity, 0, sizeof(saved), saved);
+    if (!TEST_true(n > 0))
+        goto err;
+    for (i = 0; i < TEST_MAX_CPUS; i++) {
+        if ((saved[i / bits] & (1UL << (i % bits))) == 0)
+            continue;
+        memset(mask, 0, sizeof(mask));
+        mask[i / bits] = 1UL << (i % bits);
+        if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0
+            || syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+            continue;
+        if (!TEST_true(ossl_dh_check_pub_key_hot(hot, dh, y, &flags)
+                       && flags == 0))
+            break;
+        if (!seen[node % DH_CHECK_HOT_MAX_NODES]) {
+            seen[node % DH_CHECK_HOT_MAX_NODES] = 1;
+            nnodes++;
+        }
+    }
+    syscall(SYS_sched_setaffinity, 0, sizeof(saved), saved);
+    if (i < TEST_MAX_CPUS || !TEST_true(nnodes > 0))
+        goto err;
+#else
+    if (!TEST_true(ossl_dh_check_pub_key_hot(hot, dh, y, &flags)
+                   && flags == 0))
+        goto err;
+#endif
+    if (!TEST_true(ossl_dh_check_hot_num_promoted(hot) == 1)
+        || !TEST_true(ossl_dh_check_hot_num_replicas(hot) == nnodes))
+        goto err;
+    ok = 1;
+ err:
+    if (!ok)
+        fprintf(stderr, "# %zu nodes, %zu replicas\n", nnodes,
+                hot == NULL ? 0 : ossl_dh_check_hot_num_replicas(hot));
+    BN_free(y);
+    DH_free(dh);
+    ossl_dh_check_hot_free(hot);
+    return ok;
+}
+
+static const struct {
+    const char *name;
+    int (*fn)(void);
+} tests[] = {
+    { "test_fingerprint_sign", test_fingerprint_sign },
+    { "test_known_group_sign", test_known_group_sign },
+    { "test_provenance_sign", test_provenance_sign },
+    { "test_validated_pub_key_binding", test_validated_pub_key_binding },
+    { "test_prof_counts", test_prof_counts },
+    { "test_cached_invalidation", test_cached_invalidation },
+    { "test_mask_subsets", test_mask_subsets },
+    { "test_pub_key_policy", test_pub_key_policy },
+    { "test_batch_matches_partial", test_batch_matches_partial },
+    { "test_stream_matches_partial", test_stream_matches_partial },
+    { "test_reload", test_reload },
+    { "test_async", test_async },
+#ifdef TEST_EXECUTOR
+    { "test_executor", test_executor },
+#endif
+    { "test_no_alloc", test_no_alloc },
+#ifdef TEST_STACK
+    { "test_no_alloc_stack", test_no_alloc_stack },
+#endif
+    { "test_hot_promotion", test_hot_promotion },
+    { "test_hot_replica_per_node", test_hot_replica_per_node },
+};
+
+int main(void)
+{
+    size_t i;
+    int failed = 0;
+
+    /* Must come before libcrypto's first allocation */
+    if (!CRYPTO_set_mem_functions(count_malloc, count_realloc, count_free)) {
+        printf("Bail out! CRYPTO_set_mem_functions() failed\n");
+        return EXIT_FAILURE;
+    }
+    printf("1..%d\n", (int)OSSL_NELEM(tests));
+    for (i = 0; i < OSSL_NELEM(tests); i++) {
+        int ok = tests[i].fn();
+
+        ERR_print_errors_fp(stderr);
+        printf("%sok %d - %s\n", ok ? "" : "not ", (int)i + 1, tests[i].name);
+        failed |= !ok;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2021 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * Types and entry points of dh_check.c that have no home in crypto/dh.h,
+ * shared by dh_check.c and its internal test.
+ */
+
+#ifndef OSSL_CRYPTO_DH_CHECK_LOCAL_H
+# define OSSL_CRYPTO_DH_CHECK_LOCAL_H
+# pragma once
+
+# include <openssl/bio.h>
+# include <openssl/bn.h>
+# include <openssl/dh.h>
+# include <openssl/sha.h>
+
+/*
+ * With OPENSSL_DH_CHECK_NO_ALLOC a call to a validation entry point that
+ * allocates on every call is a compile-time error (GCC and Clang), so code
+ * built for the profile cannot reach one by accident. Set-up and tear-down
+ * functions (_new, _free, getters) are not marked. dh_check.c, which
+ * implements both kinds, and tests that exercise both define
+ * DH_CHECK_ALLOW_ALLOC before including this header.
+ */
+# if defined(OPENSSL_DH_CHECK_NO_ALLOC) && !defined(DH_CHECK_ALLOW_ALLOC) \
+     && defined(__has_attribute)
+#  if __has_attribute(__error__)
+#   define DH_CHECK_ALLOCATES \
+        __attribute__((__error__("allocates: outside OPENSSL_DH_CHECK_NO_ALLOC")))
+#  endif
+# endif
+# ifndef DH_CHECK_ALLOCATES
+#  define DH_CHECK_ALLOCATES
+# endif
+
+/*
+ * Domain parameter validation strategies, selectable per call through
+ * ossl_dh_check_params_strategy() and ossl_dh_check_strategy().
+ */
+# define DH_CHECK_STRATEGY_DEFAULT     0 /* what DH_check() does in this build */
+# define DH_CHECK_STRATEGY_EXPLICIT    1 /* explicit p, q, g and j checks */
+# define DH_CHECK_STRATEGY_FIPS186_4   2 /* FIPS 186-4 regeneration from seed */
+# define DH_CHECK_STRATEGY_PREFER_SEED 3 /* FIPS186_4 with a seed, else EXPLICIT */
+
+/*
+ * Individual DH_check() tests, selectable through ossl_dh_check_mask().
+ * The cheap structural checks of DH_check_params() always run.
+ */
+# define DH_CHECK_MASK_GENERATOR       0x01 /* 1 < g < p and g^q == 1 mod p */
+# define DH_CHECK_MASK_Q_PRIME         0x02 /* q is prime */
+# define DH_CHECK_MASK_Q_DIVIDES_P     0x04 /* q divides p - 1 */
+# define DH_CHECK_MASK_J               0x08 /* j == (p - 1) / q */
+# define DH_CHECK_MASK_P_PRIME         0x10 /* p is prime */
+# define DH_CHECK_MASK_P_SAFE_PRIME    0x20 /* (p - 1) / 2 is prime, implies P_PRIME */
+# define DH_CHECK_MASK_ALL             0x3F
+
+typedef struct dh_check_cache_st DH_CHECK_CACHE;
+
+/* Key usage hints and validation levels for ossl_dh_check_pub_key_policy() */
+# define DH_KEY_USAGE_EPHEMERAL        1
+# define DH_KEY_USAGE_STATIC           2
+# define DH_PUBKEY_CHECK_PARTIAL       1 /* SP800-56Ar3 5.6.2.3.2 range check */
+# define DH_PUBKEY_CHECK_FULL          2 /* SP800-56Ar3 5.6.2.3.1 incl. y^q */
+
+/*
+ * Validated handles, handed out only by ossl_dh_validate_group() and
+ * ossl_dh_validate_pub_key(). A DH_VALIDATED_GROUP holds the DH and the
+ * fingerprint of the values DH_check() passed. A DH_VALIDATED_PUBKEY holds
+ * the key, that fingerprint and the DH_PUBKEY_CHECK_* level, see
+ * ossl_dh_validated_pub_key_get0().
+ */
+typedef struct dh_validated_group_st DH_VALIDATED_GROUP;
+typedef struct dh_validated_pubkey_st DH_VALIDATED_PUBKEY;
+
+/* Validation work that can be handed to an executor, see ossl_dh_check_job_submit() */
+# define DH_CHECK_JOB_PARAMS           1 /* DH_check() */
+# define DH_CHECK_JOB_PUB_KEY          2 /* DH_check_pub_key() */
+# define DH_CHECK_JOB_PAIRWISE         3 /* ossl_dh_check_pairwise() */
+
+typedef struct dh_check_job_st DH_CHECK_JOB;
+typedef void DH_CHECK_JOB_DONE_FN(DH_CHECK_JOB *job, void *arg);
+typedef int DH_CHECK_EXECUTOR_FN(void (*run)(void *), void *run_arg,
+                                 void *executor_arg);
+
+/*
+ * Caller-owned, so it can live in a coroutine frame or other per-request
+ * state without an allocation. Initialise with ossl_dh_check_job_init().
+ */
+struct dh_check_job_st {
+    int type;                   /* DH_CHECK_JOB_* */
+    const DH *dh;
+    const BIGNUM *pub_key;      /* DH_CHECK_JOB_PUB_KEY only */
+    int ok;                     /* return value of the check */
+    int flags;                  /* error flags of the check */
+    DH_CHECK_JOB_DONE_FN *done; /* completion callback, may be NULL */
+    void *done_arg;
+};
+
+/* Library-owned validation executor, see ossl_dh_check_executor_new() */
+typedef struct dh_check_executor_st DH_CHECK_EXECUTOR;
+
+typedef struct dh_check_executor_stats_st {
+    size_t queue_depth;         /* jobs waiting for a worker right now */
+    size_t max_queue_depth;     /* highest queue_depth seen */
+    uint64_t completed;         /* jobs run to completion */
+    uint64_t total_wait_us;     /* sum of submit-to-start times */
+    uint64_t max_wait_us;       /* longest submit-to-start time */
+} DH_CHECK_EXECUTOR_STATS;
+
+/* Parameter fingerprints and the validated sets built from them on reload */
+# define DH_PARAMS_FINGERPRINT_LEN     SHA256_DIGEST_LENGTH
+
+typedef struct dh_check_set_st DH_CHECK_SET;
+
+/*
+ * Pair-wise provenance record: version, verdict and an HMAC-SHA256 over the
+ * parameter fingerprint, public and private key and verdict.
+ */
+# define DH_PROVENANCE_VERSION         1
+# define DH_PROVENANCE_LEN             (2 + SHA256_DIGEST_LENGTH)
+# define DH_PROVENANCE_MIN_KEY_LEN     16
+
+/* Usage tracking that promotes hot custom groups to a cached fast path */
+# define DH_CHECK_HOT_DEFAULT_THRESHOLD    64
+# define DH_CHECK_HOT_DEFAULT_MAX_GROUPS   32
+# define DH_CHECK_HOT_MAX_NODES            8 /* NUMA nodes with own replicas */
+
+typedef struct dh_check_hot_st DH_CHECK_HOT;
+
+/*
+ * Incremental range check of a public key that arrives in pieces, see
+ * ossl_dh_pub_key_stream_init(). Caller-owned; treat the fields as private.
+ */
+typedef struct dh_pub_key_stream_st {
+    unsigned char bound[(OPENSSL_DH_MAX_MODULUS_BITS + 7) / 8]; /* p - 2 */
+    size_t keylen;              /* bytes expected in total */
+    size_t pos;                 /* bytes seen so far */
+    int cmp;                    /* key vs bound over bytes seen: -1, 0 or 1 */
+    int nonzero;                /* a byte before the last one was non-zero */
+    unsigned char last;         /* final byte, once seen */
+    int flags;                  /* DH_CHECK_PUBKEY_* once rejected */
+} DH_PUB_KEY_STREAM;
+
+/*
+ * Hardware-counter profiling (build with -DOPENSSL_DH_CHECK_PROFILE on Linux).
+ * Phases of the validation paths, modulus size buckets and counters as used
+ * by ossl_dh_check_prof_get().
+ */
+# define DH_CHECK_PROF_PARAMS          0 /* structural checks of DH_check_params() */
+# define DH_CHECK_PROF_GENERATOR       1 /* g^q mod p */
+# define DH_CHECK_PROF_Q_PRIME         2 /* BN_check_prime(q) */
+# define DH_CHECK_PROF_Q_DIVIDES_P     3 /* p / q for the q | p-1 and j tests */
+# define DH_CHECK_PROF_P_PRIME         4 /* BN_check_prime(p) */
+# define DH_CHECK_PROF_P_SAFE_PRIME    5 /* BN_check_prime((p-1)/2) */
+# define DH_CHECK_PROF_PUB_KEY         6 /* DH_check_pub_key() */
+# define DH_CHECK_PROF_PAIRWISE        7 /* ossl_dh_check_pairwise() */
+# define DH_CHECK_PROF_NPHASES         8
+
+# define DH_CHECK_PROF_NSIZES          7 /* p up to 1024, 2048, 3072, 4096,
+                                          * 6144, 8192 bits, and larger */
+
+# define DH_CHECK_PROF_CYCLES          0
+# define DH_CHECK_PROF_INSTRUCTIONS    1
+# define DH_CHECK_PROF_CACHE_MISSES    2
+# define DH_CHECK_PROF_BRANCH_MISSES   3
+# define DH_CHECK_PROF_NCOUNTERS       4
+
+typedef struct dh_check_prof_stats_st {
+    uint64_t calls;
+    uint64_t ns;                                /* wall-clock time */
+    uint64_t count[DH_CHECK_PROF_NCOUNTERS];    /* summed counter deltas */
+    uint64_t samples[DH_CHECK_PROF_NCOUNTERS];  /* calls that had the counter */
+} DH_CHECK_PROF_STATS;
+
+/*
+ * Entry points of dh_check.c beyond the DH_check*() family. ossl_dh_check_*
+ * functions that predate them are declared in crypto/dh.h; those that
+ * allocate are declared again here to mark them.
+ */
+int DH_check(const DH *dh, int *codes) DH_CHECK_ALLOCATES;
+int DH_check_ex(const DH *dh) DH_CHECK_ALLOCATES;
+int DH_check_pub_key(const DH *dh, const BIGNUM *pub_key, int *codes)
+    DH_CHECK_ALLOCATES;
+int DH_check_pub_key_ex(const DH *dh, const BIGNUM *pub_key)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_pairwise(const DH *dh) DH_CHECK_ALLOCATES;
+
+int ossl_dh_check_params_strategy(const DH *dh, int strategy, int *ret)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_strategy(const DH *dh, int strategy, int *ret)
+    DH_CHECK_ALLOCATES;
+
+int ossl_dh_check_pub_key_partial_batch(const DH *dh,
+                                        const unsigned char *keys,
+                                        size_t keylen, size_t nkeys,
+                                        unsigned char *flags);
+int ossl_dh_pub_key_stream_init(DH_PUB_KEY_STREAM *st, const DH *dh,
+                                size_t keylen);
+int ossl_dh_pub_key_stream_feed(DH_PUB_KEY_STREAM *st, const unsigned char *in,
+                                size_t inlen, int *ret);
+int ossl_dh_pub_key_stream_final(DH_PUB_KEY_STREAM *st, int *ret);
+int ossl_dh_check_pub_key_policy(const DH *dh, const BIGNUM *pub_key,
+                                 int usage, int *level, int *ret)
+    DH_CHECK_ALLOCATES;
+
+DH_VALIDATED_GROUP *ossl_dh_validate_group(DH *dh, int *ret)
+    DH_CHECK_ALLOCATES;
+const DH *ossl_dh_validated_group_get0_dh(const DH_VALIDATED_GROUP *group);
+void ossl_dh_validated_group_free(DH_VALIDATED_GROUP *group);
+DH_VALIDATED_PUBKEY *ossl_dh_validate_pub_key(const DH_VALIDATED_GROUP *group,
+                                              BIGNUM *pub_key, int usage,
+                                              int *ret)
+    DH_CHECK_ALLOCATES;
+const BIGNUM *ossl_dh_validated_pub_key_get0(const DH_VALIDATED_PUBKEY *key,
+                                             const DH_VALIDATED_GROUP *group,
+                                             int min_level);
+void ossl_dh_validated_pub_key_free(DH_VALIDATED_PUBKEY *key);
+
+int ossl_dh_check_pairwise_ctx(const DH *dh, BN_CTX *ctx)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_params_fingerprint(const DH *dh, unsigned char *md);
+
+# ifndef FIPS_MODULE
+
+int ossl_dh_check_mask(const DH *dh, unsigned int checks, int *ret)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_params_ctx(const DH *dh, BN_CTX *ctx, int *ret);
+int ossl_dh_check_ctx(const DH *dh, BN_CTX *ctx, int *ret)
+    DH_CHECK_ALLOCATES;
+
+DH_CHECK_CACHE *ossl_dh_check_cache_new(void);
+void ossl_dh_check_cache_free(DH_CHECK_CACHE *cache);
+int ossl_dh_check_cached(const DH *dh, DH_CHECK_CACHE *cache, int *ret)
+    DH_CHECK_ALLOCATES;
+
+int ossl_dh_check_async(const DH *dh, int *ret)
+    DH_CHECK_ALLOCATES;
+void ossl_dh_check_job_init(DH_CHECK_JOB *job, int type, const DH *dh,
+                            const BIGNUM *pub_key,
+                            DH_CHECK_JOB_DONE_FN *done, void *done_arg);
+int ossl_dh_check_job_submit(DH_CHECK_JOB *job, DH_CHECK_EXECUTOR_FN *executor,
+                             void *executor_arg)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_job_result(const DH_CHECK_JOB *job, int *ret);
+
+/* Only defined in builds with POSIX threads */
+DH_CHECK_EXECUTOR *ossl_dh_check_executor_new(unsigned int nthreads,
+                                              const int *cpus, size_t ncpus,
+                                              int nice);
+void ossl_dh_check_executor_free(DH_CHECK_EXECUTOR *executor);
+int ossl_dh_check_executor_submit(void (*run)(void *), void *run_arg,
+                                  void *executor_arg);
+int ossl_dh_check_executor_run(DH_CHECK_EXECUTOR *executor, DH_CHECK_JOB *job,
+                               int *ret)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_executor_run_batch(DH_CHECK_EXECUTOR *executor,
+                                     DH_CHECK_JOB *jobs, size_t njobs)
+    DH_CHECK_ALLOCATES;
+void ossl_dh_check_executor_get_stats(DH_CHECK_EXECUTOR *executor,
+                                      DH_CHECK_EXECUTOR_STATS *stats);
+
+DH_CHECK_SET *ossl_dh_check_reload(const DH_CHECK_SET *prev,
+                                   DH *const *groups, size_t ngroups,
+                                   DH_CHECK_EXECUTOR *executor)
+    DH_CHECK_ALLOCATES;
+void ossl_dh_check_set_free(DH_CHECK_SET *set);
+int ossl_dh_check_set_get(const DH_CHECK_SET *set, size_t i, int *ret);
+void ossl_dh_check_set_get_counts(const DH_CHECK_SET *set, size_t *ncarried,
+                                  size_t *nchecked);
+
+DH_CHECK_HOT *ossl_dh_check_hot_new(unsigned int threshold, size_t max_groups);
+void ossl_dh_check_hot_free(DH_CHECK_HOT *hot);
+int ossl_dh_check_pub_key_hot(DH_CHECK_HOT *hot, const DH *dh,
+                              const BIGNUM *pub_key, int *ret)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_pub_key_hot_ctx(DH_CHECK_HOT *hot, const DH *dh,
+                                  const BIGNUM *pub_key, BN_CTX *ctx,
+                                  int *ret)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_pairwise_hot(DH_CHECK_HOT *hot, const DH *dh)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_pairwise_hot_ctx(DH_CHECK_HOT *hot, const DH *dh,
+                                   BN_CTX *ctx)
+    DH_CHECK_ALLOCATES;
+size_t ossl_dh_check_hot_num_promoted(DH_CHECK_HOT *hot);
+size_t ossl_dh_check_hot_num_replicas(DH_CHECK_HOT *hot);
+
+int ossl_dh_check_prof_get(int phase, int size, DH_CHECK_PROF_STATS *stats);
+void ossl_dh_check_prof_reset(void);
+int ossl_dh_check_prof_print(BIO *out);
+
+int ossl_dh_pairwise_provenance_create(const DH *dh, const unsigned char *key,
+                                       size_t keylen, unsigned char *rec,
+                                       size_t reclen)
+    DH_CHECK_ALLOCATES;
+int ossl_dh_check_pairwise_provenance(const DH *dh, const unsigned char *key,
+                                      size_t keylen, const unsigned char *rec,
+                                      size_t reclen)
+    DH_CHECK_ALLOCATES;
+# endif /* FIPS_MODULE */
+
+#endif